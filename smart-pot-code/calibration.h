@@ -0,0 +1,144 @@
+#pragma once
+
+// Raw ADC reading -> physical value in tenths (0.1 % or 0.1 lux)
+struct CalibrationPoint {
+  int32_t raw;
+  int32_t value;
+};
+
+// --------------------------------------------------------------------------
+// ------------------------- PROBE MODELS -----------------------------------
+// --------------------------------------------------------------------------
+// Points are sorted by raw value, 12-bit ADC at 11 dB attenuation.
+// REF_LOW_RAW/REF_HIGH_RAW are the nominal readings at the two per-unit
+// calibration references.
+
+// Stock probe from the component list, lower reading = drier soil
+struct StockSoilProbe {
+  static constexpr CalibrationPoint POINTS[] = {
+    { 0, 0 }, { 1200, 50 }, { 2000, 120 }, { 2600, 200 }, { 2900, 250 }, { 3300, 350 }, { 3700, 450 }, { 4095, 500 }
+  };
+  static constexpr int32_t REF_LOW_RAW = 1200;   // Dry potting soil, 5 %
+  static constexpr int32_t REF_HIGH_RAW = 3700;  // Saturated potting soil, 45 %
+};
+
+// Capacitive v1.2 probe, higher reading = drier soil
+struct CapacitiveSoilProbe {
+  static constexpr CalibrationPoint POINTS[] = {
+    { 0, 500 }, { 1300, 500 }, { 1600, 400 }, { 2000, 250 }, { 2400, 120 }, { 2800, 30 }, { 3100, 0 }, { 4095, 0 }
+  };
+  static constexpr int32_t REF_LOW_RAW = 2800;   // Dry potting soil, 3 %
+  static constexpr int32_t REF_HIGH_RAW = 1600;  // Saturated potting soil, 40 %
+};
+
+// TEMT6000 with 10k load resistor (~5 mV/lux)
+struct Temt6000LightSensor {
+  static constexpr CalibrationPoint POINTS[] = {
+    { 0, 0 }, { 100, 100 }, { 500, 600 }, { 1000, 1220 }, { 1500, 1830 }, { 2500, 3100 }, { 3500, 4600 }, { 4095, 6000 }
+  };
+  static constexpr int32_t REF_LOW_RAW = 0;      // Covered sensor, 0 lux
+  static constexpr int32_t REF_HIGH_RAW = 1500;  // ~183 lux
+};
+
+// --------------------------------------------------------------------------
+// ------------------------- LOOKUP TABLE -----------------------------------
+// --------------------------------------------------------------------------
+
+constexpr uint8_t CALIBRATION_LUT_SHIFT = 6;  // One entry per 64 raw counts
+constexpr size_t CALIBRATION_LUT_SIZE = (4096 >> CALIBRATION_LUT_SHIFT) + 1;
+
+struct CalibrationLookupTable {
+  int32_t values[CALIBRATION_LUT_SIZE];
+};
+
+// Compile-time index list (std::index_sequence is C++14, older ESP32 cores build as C++11)
+template<size_t... I>
+struct IndexList {};
+template<size_t N, size_t... I>
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+template<size_t... I>
+struct MakeIndexList<0, I...> {
+  typedef IndexList<I...> type;
+};
+
+// Piecewise-linear interpolation of the probe points, evaluated at compile time.
+// Written as single-return recursion so it stays a C++11 constexpr.
+template<typename Probe>
+constexpr size_t findSegment(int32_t raw, size_t segment = 0) {
+  return (segment + 2 < sizeof(Probe::POINTS) / sizeof(Probe::POINTS[0]) && raw > Probe::POINTS[segment + 1].raw)
+           ? findSegment<Probe>(raw, segment + 1)
+           : segment;
+}
+
+constexpr int32_t interpolate(const CalibrationPoint& a, const CalibrationPoint& b, int32_t raw) {
+  return raw < a.raw   ? a.value
+         : raw > b.raw ? b.value
+                       : a.value + (b.value - a.value) * (raw - a.raw) / (b.raw - a.raw);
+}
+
+template<typename Probe>
+constexpr int32_t tableValue(size_t index) {
+  return interpolate(Probe::POINTS[findSegment<Probe>(index << CALIBRATION_LUT_SHIFT)],
+                     Probe::POINTS[findSegment<Probe>(index << CALIBRATION_LUT_SHIFT) + 1],
+                     index << CALIBRATION_LUT_SHIFT);
+}
+
+template<typename Probe, size_t... I>
+constexpr CalibrationLookupTable buildLookupTable(IndexList<I...>) {
+  return CalibrationLookupTable{ { tableValue<Probe>(I)... } };
+}
+
+template<typename Probe>
+constexpr CalibrationLookupTable buildLookupTable() {
+  return buildLookupTable<Probe>(typename MakeIndexList<CALIBRATION_LUT_SIZE>::type());
+}
+
+// --------------------------------------------------------------------------
+// ------------------------- CONVERTER --------------------------------------
+// --------------------------------------------------------------------------
+
+template<typename Probe>
+class SensorConverter {
+private:
+  static constexpr CalibrationLookupTable TABLE = buildLookupTable<Probe>();
+
+  // Per-unit correction mapping this unit's readings onto the nominal probe curve (Q16 gain)
+  int32_t measuredLow;
+  int32_t gain;
+
+public:
+  SensorConverter()
+    : measuredLow(Probe::REF_LOW_RAW),
+      gain(1 << 16) {}
+
+  // Two-point calibration from this unit's readings at the probe's reference points (0 = nominal)
+  void setCalibration(int32_t measuredLowRaw, int32_t measuredHighRaw) {
+    if (measuredLowRaw <= 0 || measuredHighRaw <= 0 || measuredLowRaw == measuredHighRaw) {
+      measuredLow = Probe::REF_LOW_RAW;
+      gain = 1 << 16;
+      return;
+    }
+    measuredLow = measuredLowRaw;
+    gain = (int64_t)(Probe::REF_HIGH_RAW - Probe::REF_LOW_RAW) * 65536 / (measuredHighRaw - measuredLowRaw);
+  }
+
+  // Raw ADC -> tenths of the physical unit; one multiply for calibration, one table step
+  inline int32_t convert(int32_t raw) const {
+    int32_t corrected = Probe::REF_LOW_RAW + (int32_t)(((int64_t)(raw - measuredLow) * gain) >> 16);
+    if (corrected < 0) corrected = 0;
+    if (corrected > 4095) corrected = 4095;
+
+    uint32_t index = corrected >> CALIBRATION_LUT_SHIFT;
+    int32_t fraction = corrected & ((1 << CALIBRATION_LUT_SHIFT) - 1);
+    int32_t low = TABLE.values[index];
+    return low + (((TABLE.values[index + 1] - low) * fraction) >> CALIBRATION_LUT_SHIFT);
+  }
+};
+
+// Out-of-line definitions for the ODR-used static members, required before C++17
+// (redundant but allowed from C++17 on; the sketch is a single translation unit)
+constexpr CalibrationPoint StockSoilProbe::POINTS[];
+constexpr CalibrationPoint CapacitiveSoilProbe::POINTS[];
+constexpr CalibrationPoint Temt6000LightSensor::POINTS[];
+template<typename Probe>
+constexpr CalibrationLookupTable SensorConverter<Probe>::TABLE;
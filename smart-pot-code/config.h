@@ -4,24 +4,37 @@
 // ------------------------- CONSTANTS --------------------------------------
 // --------------------------------------------------------------------------
 
-// Pins
+// Pins (v4 sensor board: IO0 soil probe, IO1 DS18B20, IO2 TEMT6000, IO3 buzzer, IO4 and up unconnected)
 const uint8_t MOISTURE_PIN = 0;
 const uint8_t DS_TEMP_PIN = 1;
 const uint8_t LDR_PIN = 2;
 const uint8_t BUZZER_PIN = 3;
 
-// Startup sound
-const int MELODY[] = { 1000, 1500, 2000 };
-const int DURATIONS[] = { 200, 200, 300 };
-const int DELAYS[] = { 250, 250, 350 };
+// Optional battery sensing, -1 = not fitted (needs rework on the v4 board, see README "Battery & Power Tiers")
+const int8_t BATTERY_PIN = -1;  // 1:2 divider from BAT+, ADC1 pin only: IO4 is the free one
+const int8_t CHARGE_PIN = -1;   // TP4056 CHRG through a diode, e.g. IO5
+
+// Optional status LEDs, -1 = not fitted (the board's LEDs are the TP4056 charge indicators)
+const int8_t RED_LED_PIN = -1;
+const int8_t GREEN_LED_PIN = -1;
 
 // MQTT
 const char* MQTT_TOPIC_WATER_COMMAND = "smartpot/water_command";
 const char* MQTT_TOPIC_LAST_WATERING_TIME = "smartpot/last_watering_time";
 const char* MQTT_TOPIC_TEMPERATURE = "smartpot/temperature";
 const char* MQTT_TOPIC_SOIL_MOISTURE = "smartpot/soil_moisture";
+const char* MQTT_TOPIC_SOIL_MOISTURE_PERCENT = "smartpot/soil_moisture_percent";
+const char* MQTT_TOPIC_LIGHT_LUX = "smartpot/light_lux";
 const char* MQTT_TOPIC_SUNLIGHT_PRESENCE = "smartpot/sunlight_presence";
+const char* MQTT_TOPIC_DIAGNOSTICS = "smartpot/diagnostics";
+const char* MQTT_TOPIC_BATTERY_VOLTAGE = "smartpot/battery_voltage";
+const char* MQTT_TOPIC_POWER_TIER = "smartpot/power_tier";
+const char* MQTT_TOPIC_OTA = "smartpot/ota/pot";              // Payload: URL of a delta or full image
+const char* MQTT_TOPIC_OTA_STATUS = "smartpot/ota_status";
+const char* MQTT_TOPIC_TRACE = "smartpot/trace";              // Decision trace CSV chunks, flushed before each sleep
 constexpr int MQTT_RECONNECT_ATTEMPTS = 5;
+constexpr bool MQTT_PERSISTENT_SESSION = true;  // Stable client ID + cleanSession=false, broker keeps subscriptions while asleep
+constexpr uint16_t MQTT_KEEPALIVE = 60;         // Seconds, longer than a typical wake so no pings are needed
 
 // Timing variables
 const unsigned long LIGHT_SEND_INTERVAL = 60000UL;       // 1 minute
@@ -29,17 +42,61 @@ const unsigned long DARK_SEND_INTERVAL = 1800000000ULL;  // 30 minutes in micros
 const unsigned long AP_TIMEOUT = 180000UL;               // 3 minutes for AP mode on cold boot
 const unsigned long WIFI_RETRY_INTERVAL = 15000UL;       // 15 seconds between WiFi connection attempts
 
+// OTA updates (see ota-updater.h)
+const unsigned long OTA_READ_TIMEOUT = 10000UL;     // Abort a download stalled for 10 seconds
+const unsigned long OTA_VERIFY_TIMEOUT = 360000UL;  // New image must publish within 6 minutes (covers the AP window) or roll back
+const char* OTA_KEY = "";  // Shared secret that signs updates (tools/ota-delta.py), set your own; empty = updates refused
+
+// Predictive wake scheduling
+const unsigned long MIN_SLEEP_TIME = 600000UL;               // 10 minutes
+const unsigned long MAX_SLEEP_TIME = 7200000UL;              // 2 hours
+const unsigned long DRYING_MIN_SAMPLE_INTERVAL = 600000UL;   // 10 minutes between model samples
+const int DRYING_REWET_THRESHOLD = 30;                       // Moisture rise (0.1 %) treated as watering/rain
+const float DRYING_MODEL_DECAY = 0.9;                        // Weight kept by older drying rate samples
+const float DRYING_MIN_WEIGHT = 2.5;                         // ~3 samples before predictions are used
+const float DRYING_SAFETY_FACTOR = 0.75;                     // Wake before the predicted threshold crossing
+
+// Battery & power tiers (see power-monitor.h)
+const float BATTERY_DIVIDER_RATIO = 2.0;     // Battery voltage / ADC pin voltage
+const int BATTERY_SAMPLES = 8;
+const int POWER_SAVING_PERCENT = 40;         // Below: saving tier
+const int POWER_CRITICAL_PERCENT = 15;       // Below: critical tier
+const int POWER_HYSTERESIS_PERCENT = 5;      // Charge needed above a threshold to recover the tier
+const int POWER_RADIO_SAG_MV = 100;          // Added back to readings taken with WiFi on before they can drop the tier
+const uint8_t POWER_SAVING_STRETCH = 2;      // Publish interval & sleep multiplier in saving tier
+const uint8_t POWER_CRITICAL_STRETCH = 4;    // ... and in critical tier
+
+// History (flash ring buffers in the "history" partition, see partitions.csv)
+const char* HISTORY_PARTITION_LABEL = "history";
+const uint8_t HISTORY_PARTITION_SUBTYPE = 0x40;
+const uint32_t HISTORY_RAW_SECTORS = 6;        // 2046 raw samples, >24 h at one sample per minute
+const uint32_t HISTORY_15MIN_SECTORS = 10;     // 3410 means, >30 days
+const uint32_t HISTORY_HOURLY_SECTORS = 27;    // 9207 means, >1 year
+const uint32_t HISTORY_LAYOUT_VERSION = 2;     // Bump when the layout or units change to reformat
+const time_t HISTORY_MIN_VALID_TIME = 1700000000;  // Samples before NTP sync are dropped
+
 // Watering
 const unsigned long WATERING_COOLDOWN = 300000UL;  // 5 minutes between watering cycles
 const char* WATERING_CODE = "1";
 
-// Buzzer
+// Decision trace (RTC ring buffer, flushed to MQTT_TOPIC_TRACE before each sleep, dump with 't' on Serial)
+const uint16_t TRACE_CAPACITY = 192;    // 12 bytes per entry, holds several offline wakes between flushes
+const uint8_t TRACE_FLUSH_ENTRIES = 5;  // Lines per MQTT chunk, keeps a chunk inside PubSubClient's 256 byte buffer
+const int TRACE_MOISTURE_DELTA = 5;     // Log moisture changes of 0.5 % or more
+
+// Buzzer & status LEDs (patterns in sequencer.h)
+const unsigned long WATERING_INDICATION_TIME = 5000UL;      // Show watering pattern for 5 seconds
 const unsigned long LOW_MOISTURE_BEEP_INTERVAL = 300000UL;  // 5 minutes (5 * 60 * 1000)
 const unsigned int LOW_MOISTURE_HZ = 3700;
 
-// Thresholds
-const int MOISTURE_THRESHOLD = 2900;
-const int SUNLIGHT_THRESHOLD = 1500;
+// Thresholds in physical units (will be overridden by saved config)
+float MOISTURE_THRESHOLD_PERCENT = 25.0;  // Volumetric water content, dry below this
+float SUNLIGHT_THRESHOLD_LUX = 183.0;     // Dark at or below this
+const float SUNLIGHT_THRESHOLD_MAX_LUX = 600.0;  // Top of the TEMT6000 curve in calibration.h, /config rejects more
+
+// Per-unit moisture probe calibration: raw readings at the probe's reference points (0 = nominal curve)
+int MOISTURE_CAL_LOW_RAW = 0;
+int MOISTURE_CAL_HIGH_RAW = 0;
 
 // Captive portal
 const IPAddress localIP(192, 168, 4, 1);
@@ -64,6 +121,8 @@ const char* NTP_SERVER_URL = "pool.ntp.org";
 float temperature = 0.0;
 int ldrValue = 0;
 int moisture = 0;
+int moistureLevel = 0;  // Tenths of volumetric %
+int lightLevel = 0;     // Tenths of lux
 
 // Connection state management
 enum WiFiState {
@@ -77,6 +136,8 @@ enum WiFiState {
 WiFiState currentWiFiState = WIFI_SETUP_MODE;
 unsigned long lastWiFiAttempt = 0;
 bool isColdBoot = false;
+bool wifiLinkLost = false;  // A connect failed or the link dropped, the next connect counts as a reconnect
+bool mqttLinkLost = false;  // Same for the broker connection
 
 // Helper variables
 unsigned long wateringStartTime = 0;
@@ -97,4 +158,5 @@ RTC_DATA_ATTR struct {
   unsigned long totalSleepTime = 0;
   unsigned long lastLowMoistureBeep = 0;  // Track last low moisture beep time
   unsigned long lastWateringTime = 0;     // Track last watering time across sleep cycles
+  unsigned long lastSleepDuration = 0;    // Scheduled length of the last deep sleep (ms)
 } rtcData;
\ No newline at end of file
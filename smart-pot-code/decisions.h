@@ -0,0 +1,79 @@
+#pragma once
+
+// Watering, beep and sleep decisions. No hardware access, so tools/trace-replay.cpp
+// runs this same code on a host against a recorded trace.
+// 'now' is the sleep-adjusted clock (rtcData.totalSleepTime + millis()),
+// 'currentMillis' the plain millis() of this wake.
+class DecisionLogic {
+private:
+  unsigned long lastMoistureCheck;  // millis() of the last watering check
+  unsigned long readySince;         // millis() when the sleep conditions first held, 0 = not yet
+
+public:
+  DecisionLogic()
+    : lastMoistureCheck(0),
+      readySince(0) {}
+
+  static inline bool isSoilDry(int moistureLevel) {
+    return moistureLevel < MOISTURE_THRESHOLD_PERCENT * 10;
+  }
+  static inline bool isDark(int lightLevel) {
+    return lightLevel <= SUNLIGHT_THRESHOLD_LUX * 10;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- WATERING ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Watering is checked every 2 seconds while the broker is reachable
+  bool isWateringCheckDue(unsigned long currentMillis) {
+    if (currentMillis - lastMoistureCheck < 2000) return false;
+    lastMoistureCheck = currentMillis;
+    return true;
+  }
+
+  // Dry soil outside the cooldown; a watering also restarts the low-moisture beep interval
+  bool shouldWater(unsigned long now, int moistureLevel) {
+    if (!isSoilDry(moistureLevel) || now - rtcData.lastWateringTime < WATERING_COOLDOWN) return false;
+    rtcData.lastWateringTime = now;
+    rtcData.lastLowMoistureBeep = now;
+    return true;
+  }
+
+  inline unsigned long cooldownRemaining(unsigned long now) const {
+    unsigned long elapsed = now - rtcData.lastWateringTime;
+    return elapsed < WATERING_COOLDOWN ? WATERING_COOLDOWN - elapsed : 0;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- BEEP -------------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Low-moisture reminder, at most every LOW_MOISTURE_BEEP_INTERVAL, muted below the normal power tier
+  bool shouldBeep(unsigned long now, int moistureLevel, bool buzzerAllowed) {
+    if (!isSoilDry(moistureLevel) || !buzzerAllowed || now - rtcData.lastLowMoistureBeep < LOW_MOISTURE_BEEP_INTERVAL) {
+      return false;
+    }
+    rtcData.lastLowMoistureBeep = now;
+    return true;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- SLEEP ------------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Awake 15 s, dark (unless saving power), data sent this wake, and 10 s on the broker for a watering decision
+  bool canSleep(unsigned long currentMillis, unsigned long wakeupTime, bool dark, bool staysAwakeInDaylight,
+                bool dataSent, bool mqttConnected) {
+    if (currentMillis - wakeupTime < 15000) return false;
+    if ((!dark && staysAwakeInDaylight) || !dataSent || !mqttConnected) return false;
+
+    if (readySince == 0) readySince = currentMillis;
+    return currentMillis - readySince >= 10000;
+  }
+
+  // Sleep (ms) until the soil is predicted to need attention, stretched on a low battery
+  inline unsigned long sleepTime(const DryingModel& model, int moistureLevel, float temperatureC, uint8_t stretch) const {
+    return model.nextSleepTime(moistureLevel, temperatureC) * stretch;
+  }
+};
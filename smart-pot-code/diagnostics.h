@@ -0,0 +1,94 @@
+#pragma once
+#include <esp_heap_caps.h>
+
+// Event counters kept in RTC memory so they survive deep sleep
+RTC_DATA_ATTR struct {
+  uint32_t wifiReconnects = 0;
+  uint32_t mqttReconnects = 0;
+  uint32_t publishFailures = 0;
+  uint32_t wateringCommands = 0;
+} diagCounters;
+
+class Diagnostics {
+private:
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;
+  uint32_t largestFreeBlock;
+  uint32_t stackHighWaterMark;
+  uint32_t connectToPublishMs;
+
+public:
+  Diagnostics()
+    : freeHeap(0),
+      minFreeHeap(0),
+      largestFreeBlock(0),
+      stackHighWaterMark(0),
+      connectToPublishMs(0) {}
+
+  // --------------------------------------------------------------------------
+  // ------------------------- SAMPLING ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Cheap heap/stack snapshot, call from the loop task
+  void sample() {
+    freeHeap = ESP.getFreeHeap();
+    minFreeHeap = ESP.getMinFreeHeap();
+    largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stackHighWaterMark = uxTaskGetStackHighWaterMark(NULL);
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- COUNTERS ---------------------------------------
+  // --------------------------------------------------------------------------
+  inline void countWiFiReconnect() {
+    diagCounters.wifiReconnects++;
+  }
+  inline void countMQTTReconnect() {
+    diagCounters.mqttReconnects++;
+  }
+  inline void countPublishFailure() {
+    diagCounters.publishFailures++;
+  }
+  inline void countWateringCommand() {
+    diagCounters.wateringCommands++;
+  }
+  inline void setConnectToPublishTime(uint32_t ms) {
+    connectToPublishMs = ms;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- FORMATTING -------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Compact JSON for the retained MQTT topic (fits PubSubClient's 256 byte buffer)
+  int toJson(char* buffer, size_t size) const {
+    return snprintf(buffer, size,
+                    "{\"heap\":%lu,\"minHeap\":%lu,\"maxBlock\":%lu,\"stack\":%lu,"
+                    "\"wifiRc\":%lu,\"mqttRc\":%lu,\"pubFail\":%lu,\"water\":%lu,\"connMs\":%lu}",
+                    (unsigned long)freeHeap, (unsigned long)minFreeHeap,
+                    (unsigned long)largestFreeBlock, (unsigned long)stackHighWaterMark,
+                    (unsigned long)diagCounters.wifiReconnects, (unsigned long)diagCounters.mqttReconnects,
+                    (unsigned long)diagCounters.publishFailures, (unsigned long)diagCounters.wateringCommands,
+                    (unsigned long)connectToPublishMs);
+  }
+
+  // Plain "name value" lines for the /metrics endpoint
+  int toMetrics(char* buffer, size_t size) const {
+    return snprintf(buffer, size,
+                    "free_heap_bytes %lu\n"
+                    "min_free_heap_bytes %lu\n"
+                    "largest_free_block_bytes %lu\n"
+                    "loop_stack_high_water_bytes %lu\n"
+                    "wifi_reconnects_total %lu\n"
+                    "mqtt_reconnects_total %lu\n"
+                    "publish_failures_total %lu\n"
+                    "watering_commands_total %lu\n"
+                    "mqtt_connect_to_publish_ms %lu\n"
+                    "uptime_ms %lu\n",
+                    (unsigned long)freeHeap, (unsigned long)minFreeHeap,
+                    (unsigned long)largestFreeBlock, (unsigned long)stackHighWaterMark,
+                    (unsigned long)diagCounters.wifiReconnects, (unsigned long)diagCounters.mqttReconnects,
+                    (unsigned long)diagCounters.publishFailures, (unsigned long)diagCounters.wateringCommands,
+                    (unsigned long)connectToPublishMs, millis());
+  }
+};
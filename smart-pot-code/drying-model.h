@@ -0,0 +1,92 @@
+#pragma once
+
+// Drying model state kept in RTC memory across deep sleep
+RTC_DATA_ATTR struct {
+  bool hasSample = false;
+  unsigned long lastSampleTime = 0;  // ms on the sleep-adjusted clock
+  int lastMoisture = 0;              // Tenths of volumetric %
+  float lastTemperature = 20.0;
+  // Exponentially weighted sums for the fit: rate = a + b * temperature
+  float sumW = 0.0;
+  float sumT = 0.0;
+  float sumR = 0.0;
+  float sumTT = 0.0;
+  float sumTR = 0.0;
+} dryingState;
+
+class DryingModel {
+private:
+  static inline bool isValidTemperature(float temperatureC) {
+    return temperatureC > -55 && temperatureC < 125;
+  }
+
+public:
+  // --------------------------------------------------------------------------
+  // ------------------------- LEARNING ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Feed a reading taken at 'now' (ms). Intervals containing a watering are not learned.
+  void addSample(unsigned long now, int moistureValue, float temperatureC, bool wateredSinceLastSample) {
+    if (!isValidTemperature(temperatureC)) temperatureC = dryingState.lastTemperature;
+
+    if (dryingState.hasSample) {
+      unsigned long elapsed = now - dryingState.lastSampleTime;
+      if (elapsed < DRYING_MIN_SAMPLE_INTERVAL) return;
+
+      int change = moistureValue - dryingState.lastMoisture;
+      if (!wateredSinceLastSample && change < DRYING_REWET_THRESHOLD) {
+        float rate = change / (elapsed / 3600000.0);  // 0.1 % per hour
+        float t = (temperatureC + dryingState.lastTemperature) / 2;
+
+        dryingState.sumW = dryingState.sumW * DRYING_MODEL_DECAY + 1;
+        dryingState.sumT = dryingState.sumT * DRYING_MODEL_DECAY + t;
+        dryingState.sumR = dryingState.sumR * DRYING_MODEL_DECAY + rate;
+        dryingState.sumTT = dryingState.sumTT * DRYING_MODEL_DECAY + t * t;
+        dryingState.sumTR = dryingState.sumTR * DRYING_MODEL_DECAY + t * rate;
+      }
+    }
+
+    dryingState.hasSample = true;
+    dryingState.lastSampleTime = now;
+    dryingState.lastMoisture = moistureValue;
+    dryingState.lastTemperature = temperatureC;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- PREDICTION -------------------------------------
+  // --------------------------------------------------------------------------
+
+  inline bool isTrained() const {
+    return dryingState.sumW >= DRYING_MIN_WEIGHT;
+  }
+
+  // Predicted moisture change in 0.1 % per hour (negative = drying)
+  float predictRate(float temperatureC) const {
+    float meanT = dryingState.sumT / dryingState.sumW;
+    float meanR = dryingState.sumR / dryingState.sumW;
+    float varT = dryingState.sumTT / dryingState.sumW - meanT * meanT;
+
+    // Not enough temperature spread yet, use the mean rate
+    if (!isValidTemperature(temperatureC) || varT < 1.0) return meanR;
+
+    float covTR = dryingState.sumTR / dryingState.sumW - meanT * meanR;
+    return meanR + (covTR / varT) * (temperatureC - meanT);
+  }
+
+  // Sleep time (ms) until moisture is predicted to reach MOISTURE_THRESHOLD_PERCENT, within bounds
+  unsigned long nextSleepTime(int moistureValue, float temperatureC) const {
+    float threshold = MOISTURE_THRESHOLD_PERCENT * 10;
+    if (!isTrained()) return DARK_SEND_INTERVAL / 1000;
+    if (moistureValue <= threshold) return MIN_SLEEP_TIME;
+
+    float rate = predictRate(temperatureC);
+    if (rate >= -0.01) return MAX_SLEEP_TIME;
+
+    float hoursToThreshold = (moistureValue - threshold) / -rate;
+    float sleepMs = hoursToThreshold * 3600000.0 * DRYING_SAFETY_FACTOR;
+
+    if (sleepMs < MIN_SLEEP_TIME) return MIN_SLEEP_TIME;
+    if (sleepMs > MAX_SLEEP_TIME) return MAX_SLEEP_TIME;
+    return (unsigned long)sleepMs;
+  }
+};
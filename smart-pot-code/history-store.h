@@ -0,0 +1,255 @@
+#pragma once
+#include <esp_partition.h>
+#include <Preferences.h>
+#include <time.h>
+
+// One raw sample or bucket mean, 12 bytes in flash
+struct HistoryRecord {
+  uint32_t timestamp;   // Epoch seconds (bucket start for means), HISTORY_EMPTY_SLOT if erased
+  uint16_t moisture;    // Tenths of volumetric %
+  int16_t temperature;  // Centi-degrees C, HISTORY_NO_TEMPERATURE if unavailable
+  uint16_t light;       // Tenths of lux
+  uint8_t waterings;    // Watering events inside this record
+  uint8_t samples;      // Raw samples merged into this record
+};
+
+enum HistoryTier {
+  HISTORY_RAW,     // Every sample, ~24 h
+  HISTORY_15MIN,   // 15 minute means, ~30 days
+  HISTORY_HOURLY,  // Hourly means, ~1 year
+  HISTORY_TIER_COUNT
+};
+
+constexpr uint32_t HISTORY_EMPTY_SLOT = 0xFFFFFFFF;
+constexpr int16_t HISTORY_NO_TEMPERATURE = INT16_MIN;
+constexpr uint32_t HISTORY_SECTOR_SIZE = 4096;
+constexpr uint32_t HISTORY_RECORDS_PER_SECTOR = HISTORY_SECTOR_SIZE / sizeof(HistoryRecord);
+
+// Mean accumulator for one downsampled tier
+struct HistoryAccumulator {
+  uint32_t bucketStart;
+  uint32_t moistureSum;
+  int32_t temperatureSum;
+  uint32_t lightSum;
+  uint8_t temperatureCount;
+  uint8_t waterings;
+  uint8_t samples;
+};
+
+// Ring heads and pending means kept in RTC memory across deep sleep
+RTC_DATA_ATTR struct {
+  bool recovered = false;
+  uint32_t head[HISTORY_TIER_COUNT] = { 0, 0, 0 };  // Next slot to write in each ring
+  HistoryAccumulator pending[HISTORY_TIER_COUNT - 1] = {};
+} historyState;
+
+class HistoryStore {
+private:
+  const esp_partition_t* partition;
+
+  // --------------------------------------------------------------------------
+  // ------------------------- LAYOUT -----------------------------------------
+  // --------------------------------------------------------------------------
+  static inline uint32_t firstSector(uint8_t tier) {
+    if (tier == HISTORY_RAW) return 0;
+    if (tier == HISTORY_15MIN) return HISTORY_RAW_SECTORS;
+    return HISTORY_RAW_SECTORS + HISTORY_15MIN_SECTORS;
+  }
+  static inline uint32_t sectorCount(uint8_t tier) {
+    if (tier == HISTORY_RAW) return HISTORY_RAW_SECTORS;
+    if (tier == HISTORY_15MIN) return HISTORY_15MIN_SECTORS;
+    return HISTORY_HOURLY_SECTORS;
+  }
+  static inline uint32_t bucketSeconds(uint8_t tier) {
+    return tier == HISTORY_15MIN ? 900 : 3600;
+  }
+  static inline uint32_t capacity(uint8_t tier) {
+    return sectorCount(tier) * HISTORY_RECORDS_PER_SECTOR;
+  }
+  static inline uint32_t slotOffset(uint8_t tier, uint32_t slot) {
+    return (firstSector(tier) + slot / HISTORY_RECORDS_PER_SECTOR) * HISTORY_SECTOR_SIZE
+           + (slot % HISTORY_RECORDS_PER_SECTOR) * sizeof(HistoryRecord);
+  }
+
+  inline uint32_t readTimestamp(uint8_t tier, uint32_t slot) const {
+    uint32_t timestamp = HISTORY_EMPTY_SLOT;
+    esp_partition_read(partition, slotOffset(tier, slot), &timestamp, sizeof(timestamp));
+    return timestamp;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- WRITING ----------------------------------------
+  // --------------------------------------------------------------------------
+
+  // O(1) ring append; a sector is erased only when the head enters it, so wear is spread evenly
+  void append(uint8_t tier, const HistoryRecord& record) {
+    uint32_t slot = historyState.head[tier];
+    if (slot % HISTORY_RECORDS_PER_SECTOR == 0) {
+      esp_partition_erase_range(partition, slotOffset(tier, slot), HISTORY_SECTOR_SIZE);
+    }
+    esp_partition_write(partition, slotOffset(tier, slot), &record, sizeof(record));
+    historyState.head[tier] = (slot + 1) % capacity(tier);
+  }
+
+  void accumulate(uint8_t tier, const HistoryRecord& sample) {
+    HistoryAccumulator& acc = historyState.pending[tier - 1];
+    uint32_t bucket = sample.timestamp - sample.timestamp % bucketSeconds(tier);
+
+    // Sample belongs to a new bucket, flush the finished mean
+    if (acc.samples > 0 && acc.bucketStart != bucket) {
+      HistoryRecord mean = {
+        acc.bucketStart,
+        (uint16_t)(acc.moistureSum / acc.samples),
+        acc.temperatureCount ? (int16_t)(acc.temperatureSum / acc.temperatureCount) : HISTORY_NO_TEMPERATURE,
+        (uint16_t)(acc.lightSum / acc.samples),
+        acc.waterings,
+        acc.samples
+      };
+      append(tier, mean);
+      acc = {};
+    }
+
+    if (acc.samples == 0) acc.bucketStart = bucket;
+    if (acc.samples == UINT8_MAX) return;
+
+    acc.moistureSum += sample.moisture;
+    acc.lightSum += sample.light;
+    if (sample.temperature != HISTORY_NO_TEMPERATURE) {
+      acc.temperatureSum += sample.temperature;
+      acc.temperatureCount++;
+    }
+    acc.waterings += sample.waterings;
+    acc.samples++;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- RECOVERY ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Find each ring's head after a cold boot: newest sector by first timestamp, then first empty slot
+  void recoverHeads() {
+    for (uint8_t tier = 0; tier < HISTORY_TIER_COUNT; tier++) {
+      bool found = false;
+      uint32_t newestSector = 0;
+      uint32_t newestTime = 0;
+
+      for (uint32_t sector = 0; sector < sectorCount(tier); sector++) {
+        uint32_t timestamp = readTimestamp(tier, sector * HISTORY_RECORDS_PER_SECTOR);
+        if (timestamp != HISTORY_EMPTY_SLOT && (!found || timestamp >= newestTime)) {
+          found = true;
+          newestSector = sector;
+          newestTime = timestamp;
+        }
+      }
+
+      uint32_t head = 0;
+      if (found) {
+        head = (newestSector + 1) * HISTORY_RECORDS_PER_SECTOR;
+        for (uint32_t slot = newestSector * HISTORY_RECORDS_PER_SECTOR; slot < head; slot++) {
+          if (readTimestamp(tier, slot) == HISTORY_EMPTY_SLOT) {
+            head = slot;
+            break;
+          }
+        }
+      }
+      historyState.head[tier] = head % capacity(tier);
+    }
+    historyState.recovered = true;
+  }
+
+  // Erase the rings once per layout version (the partition may hold stale data)
+  void formatIfNeeded() {
+    Preferences historyPrefs;
+    historyPrefs.begin("history", false);
+    if (historyPrefs.getUInt("layout", 0) != HISTORY_LAYOUT_VERSION) {
+      Serial.println("History: formatting partition");
+      uint32_t totalSectors = HISTORY_RAW_SECTORS + HISTORY_15MIN_SECTORS + HISTORY_HOURLY_SECTORS;
+      esp_partition_erase_range(partition, 0, totalSectors * HISTORY_SECTOR_SIZE);
+      historyPrefs.putUInt("layout", HISTORY_LAYOUT_VERSION);
+    }
+    historyPrefs.end();
+  }
+
+public:
+  HistoryStore()
+    : partition(nullptr) {}
+
+  bool begin() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)HISTORY_PARTITION_SUBTYPE,
+                                         HISTORY_PARTITION_LABEL);
+    if (!partition) {
+      Serial.println("History: partition not found, history disabled");
+      return false;
+    }
+
+    if (!historyState.recovered) {
+      formatIfNeeded();
+      recoverHeads();
+    }
+    return true;
+  }
+
+  inline bool isAvailable() const {
+    return partition != nullptr;
+  }
+
+  // Store one sample in the raw ring and fold it into the 15 min / hourly means
+  void addSample(int moistureLevel, float temperatureC, int lightLevel, uint8_t waterings = 0) {
+    time_t now = time(nullptr);
+    if (!partition || now < HISTORY_MIN_VALID_TIME) return;  // No NTP time yet
+
+    bool temperatureValid = temperatureC > -55 && temperatureC < 125;
+    HistoryRecord sample = {
+      (uint32_t)now,
+      (uint16_t)moistureLevel,
+      temperatureValid ? (int16_t)(temperatureC * 100) : HISTORY_NO_TEMPERATURE,
+      (uint16_t)lightLevel,
+      waterings,
+      1
+    };
+
+    append(HISTORY_RAW, sample);
+    accumulate(HISTORY_15MIN, sample);
+    accumulate(HISTORY_HOURLY, sample);
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- QUERY ------------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Calls callback(record) oldest first for records in [from, to], reading a few records at a time
+  template<typename Callback>
+  void query(HistoryTier tier, uint32_t from, uint32_t to, Callback callback) const {
+    if (!partition || tier >= HISTORY_TIER_COUNT) return;
+
+    HistoryRecord chunk[16];
+    uint32_t sectors = sectorCount(tier);
+    uint32_t head = historyState.head[tier];
+
+    // Oldest data starts at the head sector if it hasn't been entered yet, otherwise right after it
+    uint32_t oldestSector = (head / HISTORY_RECORDS_PER_SECTOR + (head % HISTORY_RECORDS_PER_SECTOR ? 1 : 0)) % sectors;
+
+    for (uint32_t i = 0; i < sectors; i++) {
+      uint32_t sector = (oldestSector + i) % sectors;
+
+      // Whole sector is older than the range
+      uint32_t nextTime = readTimestamp(tier, ((sector + 1) % sectors) * HISTORY_RECORDS_PER_SECTOR);
+      if (i + 1 < sectors && nextTime != HISTORY_EMPTY_SLOT && nextTime < from) continue;
+
+      bool sectorDone = false;
+      for (uint32_t slot = 0; slot < HISTORY_RECORDS_PER_SECTOR && !sectorDone; slot += 16) {
+        uint32_t count = HISTORY_RECORDS_PER_SECTOR - slot < 16 ? HISTORY_RECORDS_PER_SECTOR - slot : 16;
+        esp_partition_read(partition, slotOffset(tier, sector * HISTORY_RECORDS_PER_SECTOR + slot),
+                           chunk, count * sizeof(HistoryRecord));
+
+        for (uint32_t r = 0; r < count; r++) {
+          if (chunk[r].timestamp == HISTORY_EMPTY_SLOT) {
+            sectorDone = true;
+            break;
+          }
+          if (chunk[r].timestamp >= from && chunk[r].timestamp <= to) callback(chunk[r]);
+        }
+      }
+    }
+  }
+};
@@ -143,6 +143,24 @@ const char index_html[] PROGMEM = R"rawliteral(
         </div>
       </div>
 
+      <!-- Thresholds & Calibration Section -->
+      <div class="section">
+        <h3>Thresholds &amp; Calibration</h3>
+        <div class="input-group">
+          <input type="number" name="moisture_threshold" id="moisture_threshold" placeholder="Water below moisture (%)" value="%MOISTURE_THRESHOLD%" min="0" max="100" step="0.1">
+        </div>
+        <div class="input-group">
+          <input type="number" name="sunlight_threshold" id="sunlight_threshold" placeholder="Dark below light (lux)" value="%SUNLIGHT_THRESHOLD%" min="0" max="600" step="1">
+        </div>
+        <div class="input-group">
+          <input type="number" name="moisture_cal_low" id="moisture_cal_low" placeholder="Probe reading in dry soil" value="%MOISTURE_CAL_LOW%" min="0" max="4095">
+        </div>
+        <div class="input-group">
+          <input type="number" name="moisture_cal_high" id="moisture_cal_high" placeholder="Probe reading in saturated soil" value="%MOISTURE_CAL_HIGH%" min="0" max="4095">
+        </div>
+        <div class="small-text">Current probe reading: %MOISTURE_RAW%. Leave calibration at 0 to use the nominal probe curve.</div>
+      </div>
+
       <button type="submit" id="submitBtn">Save Configuration</button>
       <div class="loading" id="loading">Saving configuration...</div>
       <div class="success" id="success">Configuration saved! Closing...</div>
@@ -0,0 +1,395 @@
+#pragma once
+#include <HTTPClient.h>
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/md.h>
+#include <mbedtls/sha256.h>
+#include <rom/miniz.h>
+
+// Delta format (little endian), built by tools/ota-delta.py against the running .bin:
+//   header  "SPD1", u32 target size, source SHA-256, target SHA-256
+//           (source = the digest appended to the .bin, as esp_partition_get_sha256() reports it)
+//   ops     0x01 COPY u32 offset, u32 length   bytes taken from the running image
+//           0x02 DATA u32 length, <bytes>      new bytes from the stream
+//           0x00 END
+// "SPZ1" has the same header followed by the ops as one zlib stream, inflated
+// while downloading with the ROM's tinfl. A plain .bin (first byte 0xE9) is accepted as a full image update.
+// Either kind ends with a 32-byte HMAC-SHA256 of everything before it, keyed
+// with OTA_KEY; the image is only activated when it matches.
+constexpr uint8_t OTA_DELTA_MAGIC[4] = { 'S', 'P', 'D', '1' };
+constexpr uint8_t OTA_COMPRESSED_DELTA_MAGIC[4] = { 'S', 'P', 'Z', '1' };
+constexpr size_t OTA_DELTA_HEADER_SIZE = 4 + 4 + 32 + 32;
+constexpr uint8_t OTA_IMAGE_MAGIC = 0xE9;
+constexpr size_t OTA_SIGNATURE_SIZE = 32;
+
+enum OtaOp : uint8_t {
+  OTA_OP_END = 0,
+  OTA_OP_COPY = 1,
+  OTA_OP_DATA = 2
+};
+
+class OtaUpdater {
+private:
+  WiFiClient* stream;
+  const esp_partition_t* running;
+  mbedtls_sha256_context sha;
+  mbedtls_md_context_t hmac;  // Over every byte received, up to the signature
+  bool signing;
+  uint8_t buffer[512];
+
+  // Compressed ops: tinfl writes into a 32 KB ring window, allocated only during an update
+  tinfl_decompressor* inflater;
+  uint8_t* window;
+  uint8_t input[256];
+  size_t inputPos;
+  size_t inputLength;
+  uint32_t compressedLeft;  // zlib stream bytes still on the network
+  size_t windowPos;         // Where tinfl writes next
+  size_t outputPos;         // Inflated bytes not yet consumed: window[outputPos, outputPos + outputLength)
+  size_t outputLength;
+  bool inflateDone;
+
+  uint32_t downloaded;  // Bytes received over the network
+  uint32_t written;     // Bytes written to the inactive partition
+  uint32_t durationMs;
+  bool delta;
+  bool pendingVerify;  // First boot of a new image, not yet confirmed
+  const char* error;
+
+  inline bool fail(const char* message) {
+    error = message;
+    return false;
+  }
+
+  // Blocking read of exactly 'length' bytes, gives up after OTA_READ_TIMEOUT without data
+  bool read(void* destination, size_t length) {
+    uint8_t* out = static_cast<uint8_t*>(destination);
+    size_t received = 0;
+    unsigned long lastData = millis();
+
+    while (received < length) {
+      int available = stream->available();
+      if (available > 0) {
+        int n = stream->read(out + received, min((size_t)available, length - received));
+        if (n > 0) {
+          received += n;
+          lastData = millis();
+          continue;
+        }
+      } else if (!stream->connected()) {
+        return fail("connection closed");
+      }
+      if (millis() - lastData >= OTA_READ_TIMEOUT) return fail("read timeout");
+      delay(1);
+    }
+
+    downloaded += length;
+    if (signing) mbedtls_md_hmac_update(&hmac, out, length);
+    return true;
+  }
+
+  // Delta ops, inflated when the delta is compressed
+  bool readOps(void* destination, size_t length) {
+    if (!inflater) return read(destination, length);
+
+    uint8_t* out = static_cast<uint8_t*>(destination);
+    while (length > 0) {
+      if (outputLength > 0) {
+        size_t n = min(length, outputLength);
+        memcpy(out, window + outputPos, n);
+        outputPos += n;
+        outputLength -= n;
+        out += n;
+        length -= n;
+        continue;
+      }
+      if (inflateDone) return fail("delta truncated");
+      if (!inflate()) return false;
+    }
+    return true;
+  }
+
+  // One tinfl step: refills the input from the network when it runs dry
+  bool inflate() {
+    if (inputPos == inputLength && compressedLeft > 0) {
+      size_t n = min((uint32_t)sizeof(input), compressedLeft);
+      if (!read(input, n)) return false;
+      compressedLeft -= n;
+      inputPos = 0;
+      inputLength = n;
+    }
+
+    size_t consumed = inputLength - inputPos;
+    size_t produced = TINFL_LZ_DICT_SIZE - windowPos;
+    int flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (compressedLeft > 0 ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    tinfl_status status = tinfl_decompress(inflater, input + inputPos, &consumed, window, window + windowPos, &produced, flags);
+    inputPos += consumed;
+    outputPos = windowPos;
+    outputLength = produced;
+    windowPos = (windowPos + produced) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status < TINFL_STATUS_DONE) return fail("corrupt delta");
+    if (status == TINFL_STATUS_DONE) inflateDone = true;
+    return true;
+  }
+
+  // Ops ended: the zlib stream must end too, right before the signature
+  bool finishInflate() {
+    while (!inflateDone) {
+      if (!inflate()) return false;
+      if (outputLength > 0) return fail("data after end");
+    }
+    if (outputLength > 0 || inputPos != inputLength || compressedLeft > 0) return fail("data after end");
+    return true;
+  }
+
+  bool startInflate(int contentLength) {
+    if (contentLength <= (int)(OTA_DELTA_HEADER_SIZE + OTA_SIGNATURE_SIZE)) return fail("unknown delta size");
+    inflater = static_cast<tinfl_decompressor*>(malloc(sizeof(tinfl_decompressor)));
+    window = static_cast<uint8_t*>(malloc(TINFL_LZ_DICT_SIZE));
+    if (!inflater || !window) return fail("out of memory");
+
+    tinfl_init(inflater);
+    compressedLeft = contentLength - OTA_DELTA_HEADER_SIZE - OTA_SIGNATURE_SIZE;
+    inputPos = inputLength = 0;
+    windowPos = outputPos = outputLength = 0;
+    inflateDone = false;
+    return true;
+  }
+
+  void freeInflate() {
+    free(inflater);
+    free(window);
+    inflater = nullptr;
+    window = nullptr;
+  }
+
+  inline bool readU32(uint32_t& value) {
+    uint8_t bytes[4];
+    if (!readOps(bytes, 4)) return false;
+    value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+  }
+
+  // Trailing signature, checked before anything is activated
+  bool verifySignature() {
+    uint8_t expected[OTA_SIGNATURE_SIZE];
+    uint8_t received[OTA_SIGNATURE_SIZE];
+    mbedtls_md_hmac_finish(&hmac, expected);
+    signing = false;
+    if (!read(received, sizeof(received))) return false;
+
+    uint8_t difference = 0;
+    for (size_t i = 0; i < sizeof(expected); i++) difference |= expected[i] ^ received[i];
+    return difference == 0 || fail("bad signature");
+  }
+
+  bool write(uint8_t* data, size_t length) {
+    if (Update.write(data, length) != length) return fail(Update.errorString());
+    mbedtls_sha256_update(&sha, data, length);
+    written += length;
+    return true;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- APPLY ------------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Full image, 'head' holds the bytes already read for format detection
+  bool applyFull(uint8_t* head, size_t headLength, int contentLength) {
+    if (contentLength <= (int)(headLength + OTA_SIGNATURE_SIZE)) return fail("unknown image size");
+    uint32_t imageSize = contentLength - OTA_SIGNATURE_SIZE;
+    if (!Update.begin(imageSize)) return fail(Update.errorString());
+    if (!write(head, headLength)) return false;
+
+    for (uint32_t remaining = imageSize - headLength; remaining > 0;) {
+      size_t n = min((uint32_t)sizeof(buffer), remaining);
+      if (!read(buffer, n) || !write(buffer, n)) return false;
+      remaining -= n;
+    }
+    return true;
+  }
+
+  bool applyDelta(bool compressed, int contentLength) {
+    uint32_t targetSize;
+    uint8_t sourceHash[32];
+    uint8_t targetHash[32];
+    uint8_t runningHash[32];
+    if (!readU32(targetSize) || !read(sourceHash, 32) || !read(targetHash, 32)) return false;
+
+    // Delta must have been built against exactly this image
+    if (esp_partition_get_sha256(running, runningHash) != ESP_OK || memcmp(sourceHash, runningHash, 32) != 0) {
+      return fail("delta built for another image");
+    }
+    if (compressed && !startInflate(contentLength)) return false;
+    if (!Update.begin(targetSize)) return fail(Update.errorString());
+
+    while (true) {
+      uint8_t op;
+      uint32_t offset;
+      uint32_t length;
+      if (!readOps(&op, 1)) return false;
+
+      if (op == OTA_OP_END) break;
+
+      if (op == OTA_OP_COPY) {
+        if (!readU32(offset) || !readU32(length)) return false;
+        if (length > running->size || offset > running->size - length) return fail("copy out of range");
+
+        while (length > 0) {
+          size_t n = min((uint32_t)sizeof(buffer), length);
+          if (esp_partition_read(running, offset, buffer, n) != ESP_OK) return fail("source read failed");
+          if (!write(buffer, n)) return false;
+          offset += n;
+          length -= n;
+        }
+      } else if (op == OTA_OP_DATA) {
+        if (!readU32(length)) return false;
+
+        while (length > 0) {
+          size_t n = min((uint32_t)sizeof(buffer), length);
+          if (!readOps(buffer, n) || !write(buffer, n)) return false;
+          length -= n;
+        }
+      } else {
+        return fail("bad delta op");
+      }
+
+      if (written > targetSize) return fail("delta overruns image");
+    }
+
+    if (written != targetSize) return fail("image size mismatch");
+    if (inflater && !finishInflate()) return false;
+
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&sha, hash);
+    if (memcmp(hash, targetHash, 32) != 0) return fail("image hash mismatch");
+    return true;
+  }
+
+public:
+  OtaUpdater()
+    : stream(nullptr),
+      running(nullptr),
+      signing(false),
+      inflater(nullptr),
+      window(nullptr),
+      inputPos(0),
+      inputLength(0),
+      compressedLeft(0),
+      windowPos(0),
+      outputPos(0),
+      outputLength(0),
+      inflateDone(false),
+      downloaded(0),
+      written(0),
+      durationMs(0),
+      delta(false),
+      pendingVerify(false),
+      error(nullptr) {}
+
+  // Needs verifyRollbackLater() returning true in the sketch, otherwise the core confirms every image itself
+  void begin() {
+    esp_ota_img_states_t state;
+    pendingVerify = esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK
+                    && state == ESP_OTA_IMG_PENDING_VERIFY;
+    if (pendingVerify) Serial.println("OTA: new image, waiting for confirmation");
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- UPDATE -----------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Download a delta or full image from 'url' into the inactive partition.
+  // On success the next boot runs the new image, the caller restarts.
+  bool update(const String& url) {
+    unsigned long start = millis();
+    downloaded = 0;
+    written = 0;
+    delta = false;
+    error = nullptr;
+    running = esp_ota_get_running_partition();
+    if (strlen(OTA_KEY) == 0) return fail("no OTA key configured");
+
+    HTTPClient http;
+    http.begin(url);
+    int code = http.GET();
+    if (code != HTTP_CODE_OK) {
+      http.end();
+      return fail("download failed");
+    }
+    stream = http.getStreamPtr();
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_md_init(&hmac);
+    signing = mbedtls_md_setup(&hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0
+              && mbedtls_md_hmac_starts(&hmac, (const uint8_t*)OTA_KEY, strlen(OTA_KEY)) == 0;
+
+    uint8_t head[4];
+    bool ok = signing ? read(head, sizeof(head)) : fail("HMAC setup failed");
+    if (ok) {
+      bool compressed = memcmp(head, OTA_COMPRESSED_DELTA_MAGIC, sizeof(head)) == 0;
+      delta = compressed || memcmp(head, OTA_DELTA_MAGIC, sizeof(head)) == 0;
+      if (delta) {
+        ok = applyDelta(compressed, http.getSize());
+      } else if (head[0] == OTA_IMAGE_MAGIC) {
+        ok = applyFull(head, sizeof(head), http.getSize());
+      } else {
+        ok = fail("unknown update format");
+      }
+    }
+
+    // Update.end() also validates the image before switching the boot partition
+    if (ok) ok = verifySignature();
+    if (ok && !Update.end()) ok = fail(Update.errorString());
+    if (!ok && Update.isRunning()) Update.abort();
+
+    freeInflate();
+    mbedtls_md_free(&hmac);
+    signing = false;
+    mbedtls_sha256_free(&sha);
+    http.end();
+    stream = nullptr;
+    durationMs = millis() - start;
+
+    Serial.printf("OTA %s: %s, %lu bytes downloaded, %lu byte image, %lu ms\n", delta ? "delta" : "full",
+                  ok ? "OK" : error, (unsigned long)downloaded, (unsigned long)written, (unsigned long)durationMs);
+    return ok;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- ROLLBACK ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  inline bool isPendingVerify() const {
+    return pendingVerify;
+  }
+
+  // New image proved itself, keep it
+  void confirm() {
+    if (!pendingVerify) return;
+    pendingVerify = false;
+    esp_ota_mark_app_valid_cancel_rollback();
+    Serial.println("OTA: new image confirmed");
+  }
+
+  // New image failed its checks, boot the previous one
+  void rollback() {
+    if (!pendingVerify) return;
+    Serial.println("OTA: rolling back to previous image");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- FORMATTING -------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Result of the last update for the status topic
+  int toJson(char* jsonBuffer, size_t size, const char* device) const {
+    return snprintf(jsonBuffer, size,
+                    "{\"device\":\"%s\",\"ok\":%d,\"delta\":%d,\"bytes\":%lu,\"image\":%lu,\"ms\":%lu,\"error\":\"%s\"}",
+                    device, error ? 0 : 1, delta ? 1 : 0, (unsigned long)downloaded, (unsigned long)written,
+                    (unsigned long)durationMs, error ? error : "");
+  }
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+// Power tiers, worst last
+enum PowerTier : uint8_t {
+  POWER_NORMAL,    // Everything on
+  POWER_SAVING,    // Longer intervals, sleep in daylight, no low-moisture buzzer
+  POWER_CRITICAL,  // Also no portal and no NTP, longest sleeps
+};
+
+// Battery-only tier kept in RTC memory so hysteresis works across deep sleep
+RTC_DATA_ATTR struct {
+  PowerTier batteryTier = POWER_NORMAL;
+} powerState;
+
+// Resting single-cell LiPo voltage to state of charge
+struct ChargePoint {
+  uint16_t millivolts;
+  uint8_t percent;
+};
+constexpr ChargePoint LIPO_CURVE[] = {
+  { 3300, 0 }, { 3500, 5 }, { 3600, 10 }, { 3700, 25 }, { 3750, 40 }, { 3800, 50 },
+  { 3850, 60 }, { 3900, 70 }, { 4000, 80 }, { 4100, 90 }, { 4200, 100 }
+};
+
+class PowerMonitor {
+private:
+  uint16_t millivolts;
+  uint8_t percent;
+  bool charging;
+
+  static uint8_t chargeFromVoltage(uint16_t mv) {
+    constexpr size_t points = sizeof(LIPO_CURVE) / sizeof(LIPO_CURVE[0]);
+    if (mv <= LIPO_CURVE[0].millivolts) return 0;
+    for (size_t i = 1; i < points; i++) {
+      if (mv < LIPO_CURVE[i].millivolts) {
+        const ChargePoint& low = LIPO_CURVE[i - 1];
+        const ChargePoint& high = LIPO_CURVE[i];
+        return low.percent + (mv - low.millivolts) * (high.percent - low.percent) / (high.millivolts - low.millivolts);
+      }
+    }
+    return 100;
+  }
+
+  static inline PowerTier tierForCharge(int charge) {
+    if (charge < POWER_CRITICAL_PERCENT) return POWER_CRITICAL;
+    if (charge < POWER_SAVING_PERCENT) return POWER_SAVING;
+    return POWER_NORMAL;
+  }
+
+public:
+  PowerMonitor()
+    : millivolts(0),
+      percent(0),
+      charging(false) {}
+
+  void begin() {
+    if (BATTERY_PIN >= 0) pinMode(BATTERY_PIN, INPUT);
+    if (CHARGE_PIN >= 0) pinMode(CHARGE_PIN, INPUT_PULLUP);
+    sample();
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- SAMPLING ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Full reading that also sets the tier, call only before WiFi starts: TX current sags the cell
+  void sample() {
+    // No divider fitted: report a full battery so the pot runs normally
+    if (BATTERY_PIN < 0) {
+      percent = 100;
+      powerState.batteryTier = POWER_NORMAL;
+      return;
+    }
+
+    sampleVoltage();
+    percent = chargeFromVoltage(millivolts);
+
+    // Drop a tier as soon as a threshold is crossed, recover only once clearly above it
+    PowerTier tier = tierForCharge(percent);
+    if (tier < powerState.batteryTier) tier = tierForCharge(percent - POWER_HYSTERESIS_PERCENT);
+    powerState.batteryTier = tier;
+  }
+
+  // Reading while the radio is on, e.g. during a long daylight wake: the tier can only drop here,
+  // and only if the cell is below the threshold even with the TX sag added back. Recovery waits for the next wake.
+  // Returns true if the tier dropped.
+  bool sampleInSession() {
+    if (BATTERY_PIN < 0) return false;
+
+    sampleVoltage();
+    uint8_t sessionPercent = chargeFromVoltage(millivolts + POWER_RADIO_SAG_MV);
+    if (sessionPercent < percent) percent = sessionPercent;
+
+    PowerTier tier = tierForCharge(sessionPercent);
+    if (tier <= powerState.batteryTier) return false;
+    powerState.batteryTier = tier;
+    return true;
+  }
+
+  // Refreshes the reported voltage and charge state, tier and percent stay as they are
+  void sampleVoltage() {
+    if (BATTERY_PIN < 0) return;
+
+    uint32_t sum = 0;
+    for (int i = 0; i < BATTERY_SAMPLES; i++) {
+      sum += analogReadMilliVolts(BATTERY_PIN);
+    }
+    millivolts = sum / BATTERY_SAMPLES * BATTERY_DIVIDER_RATIO;
+    charging = CHARGE_PIN >= 0 && digitalRead(CHARGE_PIN) == LOW;  // TP4056 CHRG is open drain, low while charging
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- GETTERS ----------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Solar charging pays for this wake, allow one tier more
+  inline PowerTier getTier() const {
+    PowerTier tier = powerState.batteryTier;
+    return (charging && tier > POWER_NORMAL) ? (PowerTier)(tier - 1) : tier;
+  }
+  inline bool isBatterySensed() const {
+    return BATTERY_PIN >= 0;
+  }
+  inline uint16_t getMillivolts() const {
+    return millivolts;
+  }
+  inline uint8_t getPercent() const {
+    return percent;
+  }
+  inline bool isCharging() const {
+    return charging;
+  }
+  const char* getTierName() const {
+    static const char* const NAMES[] = { "normal", "saving", "critical" };
+    return NAMES[getTier()];
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- POLICY -----------------------------------------
+  // --------------------------------------------------------------------------
+  inline bool allowsBuzzer() const {
+    return getTier() == POWER_NORMAL;
+  }
+  inline bool allowsPortal() const {
+    return getTier() != POWER_CRITICAL;
+  }
+  inline bool allowsTimeSync() const {
+    return getTier() != POWER_CRITICAL;
+  }
+  inline bool staysAwakeInDaylight() const {
+    return getTier() == POWER_NORMAL;
+  }
+
+  // Factor applied to publish intervals and sleep times
+  inline uint8_t getStretch() const {
+    return getTier() == POWER_CRITICAL ? POWER_CRITICAL_STRETCH : getTier() == POWER_SAVING ? POWER_SAVING_STRETCH : 1;
+  }
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <esp_timer.h>
+
+// One pattern step: buzzer frequency (0 = silent) or LED bitmask, held for durationMs
+struct PatternStep {
+  uint16_t value;
+  uint16_t durationMs;
+};
+
+// LED bitmask values
+constexpr uint16_t LED_OFF = 0;
+constexpr uint16_t LED_RED = 1 << 0;
+constexpr uint16_t LED_GREEN = 1 << 1;
+
+// --------------------------------------------------------------------------
+// ------------------------- PATTERNS ---------------------------------------
+// --------------------------------------------------------------------------
+
+// Buzzer
+constexpr PatternStep STARTUP_MELODY[] = { { 1000, 200 }, { 0, 50 }, { 1500, 200 }, { 0, 50 }, { 2000, 300 }, { 0, 50 } };
+constexpr PatternStep LOW_MOISTURE_BEEP[] = { { LOW_MOISTURE_HZ, 200 } };
+
+// Status LEDs (looped)
+// Slow green: portal open
+constexpr PatternStep LED_SETUP_MODE[] = { { LED_GREEN, 500 }, { LED_OFF, 500 } };
+// Fast green: joining WiFi
+constexpr PatternStep LED_CONNECTING[] = { { LED_GREEN, 100 }, { LED_OFF, 100 } };
+// Green heartbeat: all good
+constexpr PatternStep LED_CONNECTED[] = { { LED_GREEN, 50 }, { LED_OFF, 2950 } };
+// Single red blink: WiFi down
+constexpr PatternStep LED_WIFI_FAILED[] = { { LED_RED, 200 }, { LED_OFF, 1800 } };
+// Double red blink: broker unreachable
+constexpr PatternStep LED_MQTT_DOWN[] = { { LED_RED, 100 }, { LED_OFF, 100 }, { LED_RED, 100 }, { LED_OFF, 1700 } };
+// Alternating red/green: watering
+constexpr PatternStep LED_WATERING[] = { { LED_GREEN, 150 }, { LED_RED, 150 } };
+
+// --------------------------------------------------------------------------
+// ------------------------- PLAYER -----------------------------------------
+// --------------------------------------------------------------------------
+
+// Plays a pattern from an esp_timer callback so the main loop never waits on feedback
+class PatternPlayer {
+public:
+  typedef void (*OutputFunction)(uint16_t value);
+
+private:
+  OutputFunction output;
+  esp_timer_handle_t timer;
+  portMUX_TYPE lock;
+  const PatternStep* steps;
+  uint8_t length;
+  uint8_t index;
+  bool looping;
+
+  static void onTimer(void* arg) {
+    static_cast<PatternPlayer*>(arg)->advance();
+  }
+
+  void advance() {
+    PatternStep step;
+    portENTER_CRITICAL(&lock);
+    if (!steps) {
+      portEXIT_CRITICAL(&lock);
+      return;
+    }
+    if (++index >= length) {
+      if (!looping) {
+        steps = nullptr;
+        portEXIT_CRITICAL(&lock);
+        output(0);
+        return;
+      }
+      index = 0;
+    }
+    step = steps[index];
+    portEXIT_CRITICAL(&lock);
+
+    runStep(step);
+  }
+
+  inline void runStep(const PatternStep& step) {
+    output(step.value);
+    esp_timer_start_once(timer, (uint64_t)step.durationMs * 1000ULL);
+  }
+
+  void start(const PatternStep* pattern, uint8_t patternLength, bool loop) {
+    // Same looping pattern already running, keep its phase
+    if (loop && looping && steps == pattern) return;
+
+    esp_timer_stop(timer);
+    portENTER_CRITICAL(&lock);
+    steps = pattern;
+    length = patternLength;
+    index = 0;
+    looping = loop;
+    portEXIT_CRITICAL(&lock);
+
+    runStep(pattern[0]);
+  }
+
+public:
+  PatternPlayer()
+    : output(nullptr),
+      timer(nullptr),
+      steps(nullptr),
+      length(0),
+      index(0),
+      looping(false) {
+    portMUX_INITIALIZE(&lock);
+  }
+
+  void begin(OutputFunction outputFunction, const char* name) {
+    output = outputFunction;
+    esp_timer_create_args_t args = {};
+    args.callback = &PatternPlayer::onTimer;
+    args.arg = this;
+    args.name = name;
+    esp_timer_create(&args, &timer);
+    output(0);
+  }
+
+  // Play once
+  template<size_t N>
+  inline void play(const PatternStep (&pattern)[N]) {
+    start(pattern, N, false);
+  }
+
+  // Repeat until another pattern is started or stop() is called
+  template<size_t N>
+  inline void loop(const PatternStep (&pattern)[N]) {
+    start(pattern, N, true);
+  }
+
+  void stop() {
+    esp_timer_stop(timer);
+    portENTER_CRITICAL(&lock);
+    steps = nullptr;
+    looping = false;
+    portEXIT_CRITICAL(&lock);
+    output(0);
+  }
+
+  inline bool isPlaying() const {
+    return steps != nullptr;
+  }
+};
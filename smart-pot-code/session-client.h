@@ -0,0 +1,79 @@
+#pragma once
+#include <WiFiClient.h>
+
+// Pass-through network client that reads CONNACK's session-present flag,
+// which PubSubClient receives but doesn't expose.
+class SessionClient : public Client {
+private:
+  WiFiClient& inner;
+  uint8_t header[4];  // First bytes after connect: 0x20, 0x02, flags, return code
+  uint8_t headerLength;
+
+  inline void track(int value) {
+    if (value >= 0 && headerLength < sizeof(header)) header[headerLength++] = value;
+  }
+
+public:
+  explicit SessionClient(WiFiClient& client)
+    : inner(client),
+      headerLength(0) {}
+
+  // True when the broker resumed our session (subscriptions still in place)
+  inline bool isSessionPresent() const {
+    return headerLength == sizeof(header) && header[0] == 0x20 && (header[2] & 0x01);
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- CLIENT INTERFACE -------------------------------
+  // --------------------------------------------------------------------------
+  int connect(IPAddress ip, uint16_t port) {
+    headerLength = 0;
+    return inner.connect(ip, port);
+  }
+  int connect(const char* host, uint16_t port) {
+    headerLength = 0;
+    return inner.connect(host, port);
+  }
+  int connect(IPAddress ip, uint16_t port, int32_t timeout) {
+    headerLength = 0;
+    return inner.connect(ip, port, timeout);
+  }
+  int connect(const char* host, uint16_t port, int32_t timeout) {
+    headerLength = 0;
+    return inner.connect(host, port, timeout);
+  }
+  size_t write(uint8_t value) {
+    return inner.write(value);
+  }
+  size_t write(const uint8_t* data, size_t size) {
+    return inner.write(data, size);
+  }
+  int available() {
+    return inner.available();
+  }
+  int read() {
+    int value = inner.read();
+    track(value);
+    return value;
+  }
+  int read(uint8_t* data, size_t size) {
+    int count = inner.read(data, size);
+    for (int i = 0; i < count; i++) track(data[i]);
+    return count;
+  }
+  int peek() {
+    return inner.peek();
+  }
+  void flush() {
+    inner.flush();
+  }
+  void stop() {
+    inner.stop();
+  }
+  uint8_t connected() {
+    return inner.connected();
+  }
+  operator bool() {
+    return inner;
+  }
+};
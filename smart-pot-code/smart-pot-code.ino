@@ -1,5 +1,11 @@
 #include "config.h"
 #include "wifi-handler.h"
+#include "drying-model.h"
+#include "decisions.h"
+#include "calibration.h"
+#include "sequencer.h"
+#include "trace.h"
+#include "power-monitor.h"
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include <esp_sleep.h>
@@ -8,6 +14,27 @@
 OneWire oneWire(DS_TEMP_PIN);
 DallasTemperature temperatureSensor(&oneWire);
 WifiHandler wifiHandler;
+DryingModel dryingModel;
+DecisionLogic decisions;
+
+// Probe models (compile-time conversion tables)
+SensorConverter<StockSoilProbe> moistureConverter;
+SensorConverter<Temt6000LightSensor> lightConverter;
+
+// User feedback, driven from esp_timer
+PatternPlayer buzzer;
+PatternPlayer statusLeds;
+
+// Decision trace for offline replay
+TraceRecorder traceRecorder;
+
+// Battery sensing & power tier policy
+PowerMonitor powerMonitor;
+
+// Keep a freshly updated image unconfirmed until it reaches the broker (see ota-updater.h)
+extern "C" bool verifyRollbackLater() {
+  return true;
+}
 
 // Function prototypes
 void handleSensorOperations(unsigned long currentMillis);
@@ -17,6 +44,11 @@ void handleAPMode(unsigned long currentMillis);
 void handleWiFiStateMachine(unsigned long currentMillis);
 void goToDeepSleep();
 bool areAllTasksCompleted();
+void readMoisture();
+void updateStatusLeds(unsigned long currentMillis);
+void writeBuzzer(uint16_t frequency);
+void writeStatusLeds(uint16_t leds);
+void handleSerialCommands();
 
 void setup() {
   Serial.begin(115200);
@@ -25,6 +57,12 @@ void setup() {
   pinMode(LDR_PIN, INPUT);
   pinMode(MOISTURE_PIN, INPUT);
   pinMode(BUZZER_PIN, OUTPUT);
+  if (RED_LED_PIN >= 0) pinMode(RED_LED_PIN, OUTPUT);
+  if (GREEN_LED_PIN >= 0) pinMode(GREEN_LED_PIN, OUTPUT);
+
+  // Non-blocking buzzer & LED sequencers
+  buzzer.begin(writeBuzzer, "buzzer");
+  statusLeds.begin(writeStatusLeds, "leds");
 
   // Check if this is a cold boot
   esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
@@ -33,25 +71,30 @@ void setup() {
   // Play startup sound only on cold boot
   if (isColdBoot) {
     Serial.println("Cold boot detected");
-    for (int i = 0; i < 3; i++) {
-      tone(BUZZER_PIN, MELODY[i], DURATIONS[i]);
-      delay(DELAYS[i]);
-    }
+    buzzer.play(STARTUP_MELODY);
   } else {
     Serial.println("Waking from deep sleep");
   }
 
+  // Battery read before WiFi loads the cell
+  powerMonitor.begin();
+  wifiHandler.setTimeSyncEnabled(powerMonitor.allowsTimeSync());
+  Serial.printf("Battery: %u mV (%u %%%s), power tier: %s\n", powerMonitor.getMillivolts(), powerMonitor.getPercent(),
+                powerMonitor.isCharging() ? ", charging" : "", powerMonitor.getTierName());
+
   temperatureSensor.begin();
+  wifiHandler.history.begin();
+  wifiHandler.ota.begin();
 
   // Initialize or update RTC data
   if (!rtcData.isInitialized) {
-    rtcData = { true, 0, 0, 0, 0 };  // Aggregate initialization
+    rtcData = { true, 0, 0, 0, 0, 0 };  // Aggregate initialization
   } else {
     rtcData.bootCount++;
-    if (rtcData.bootCount > 1) {
-      rtcData.totalSleepTime += (DARK_SEND_INTERVAL / 1000);
-    }
+    rtcData.totalSleepTime += rtcData.lastSleepDuration;
   }
+  traceRecorder.record(TRACE_WAKE, isColdBoot, wakeup_reason);
+  traceRecorder.record(TRACE_POWER, powerMonitor.getMillivolts(), powerMonitor.getTier());
 
   // Initialize state variables
   wakeupTime = millis();
@@ -61,9 +104,22 @@ void setup() {
   // Load configuration
   bool hasCredentials = wifiHandler.loadWiFiCredentials();
   wifiHandler.loadMQTTConfig();
+  wifiHandler.loadCalibration();
+  moistureConverter.setCalibration(MOISTURE_CAL_LOW_RAW, MOISTURE_CAL_HIGH_RAW);
+  traceRecorder.recordConfig();
+
+  // The first loop decides on beeping, it needs a real reading rather than the 0 default
+  readMoisture();
+  lastMoistureReading = millis();
 
   // Determine initial WiFi state based on boot type and credentials
-  if (isColdBoot) {
+  if (isColdBoot && hasCredentials && !powerMonitor.allowsPortal()) {
+    // Battery critical - skip the configuration window
+    Serial.println("Cold boot on low battery: skipping Access Point, connecting directly...");
+    WiFi.mode(WIFI_STA);
+    currentWiFiState = WIFI_CONNECTING;
+    isColdBoot = false;
+  } else if (isColdBoot) {
     // Cold boot - start AP mode first
     Serial.println("Cold boot: Starting Access Point for configuration...");
     wifiHandler.startAccessPoint();
@@ -89,13 +145,29 @@ void loop() {
     handleAPMode(currentMillis);
   }
 
+  // Trace dump requests
+  handleSerialCommands();
+
   // State-independent operations
   isWatering = false;
   handleBuzzerAlerts(currentMillis);
 
+  // Status LEDs reflect the state the machine is about to handle
+  updateStatusLeds(currentMillis);
+
   // WiFi state machine
   handleWiFiStateMachine(currentMillis);
 
+  // Firmware update requested over MQTT or the portal
+  if (wifiHandler.hasPendingUpdate()) {
+    wifiHandler.runPendingUpdate();
+  }
+
+  // New image never reached the broker, go back to the previous one
+  if (wifiHandler.ota.isPendingVerify() && currentMillis >= OTA_VERIFY_TIMEOUT) {
+    wifiHandler.ota.rollback();
+  }
+
   // Check for deep sleep conditions
   if (!wifiHandler.isApModeActive() && areAllTasksCompleted()) {
     goToDeepSleep();
@@ -130,6 +202,8 @@ void handleAPMode(unsigned long currentMillis) {
   // Handle new credentials saved during AP mode
   if (wifiHandler.areCredentialsSaved()) {
     wifiHandler.setCredentialsSaved(false);
+    moistureConverter.setCalibration(MOISTURE_CAL_LOW_RAW, MOISTURE_CAL_HIGH_RAW);
+    traceRecorder.recordConfig();
     Serial.println("New credentials saved, stopping AP and attempting connection...");
 
     // Small delay to allow the HTTP response to be sent
@@ -152,10 +226,16 @@ void handleWiFiStateMachine(unsigned long currentMillis) {
     case WIFI_CONNECTING:
       if (wifiHandler.connectWiFi()) {
         currentWiFiState = WIFI_CONNECTED;
+        traceRecorder.record(TRACE_WIFI_UP);
         Serial.println("WiFi connected successfully!");
+
+        // The normal connect of each wake isn't a reconnect
+        if (wifiLinkLost) wifiHandler.diagnostics.countWiFiReconnect();
+        wifiLinkLost = false;
       } else {
         currentWiFiState = WIFI_FAILED;
         lastWiFiAttempt = currentMillis;
+        wifiLinkLost = true;
         Serial.println("WiFi connection failed");
       }
       break;
@@ -165,14 +245,31 @@ void handleWiFiStateMachine(unsigned long currentMillis) {
       if (WiFi.status() != WL_CONNECTED) {
         currentWiFiState = WIFI_FAILED;
         lastWiFiAttempt = currentMillis;
+        wifiLinkLost = true;
+        traceRecorder.record(TRACE_WIFI_DOWN);
         Serial.println("WiFi connection lost");
         break;
       }
 
       // Ensure MQTT connection
       if (!wifiHandler.client.connected()) {
+        static bool mqttWasConnected = false;
+        if (mqttWasConnected) {
+          traceRecorder.record(TRACE_MQTT_DOWN);
+          mqttLinkLost = true;
+        }
+
         Serial.println("Connecting to MQTT...");
         wifiHandler.reconnectMQTT();
+
+        mqttWasConnected = wifiHandler.client.connected();
+        if (mqttWasConnected) {
+          traceRecorder.record(TRACE_MQTT_UP);
+          if (mqttLinkLost) wifiHandler.diagnostics.countMQTTReconnect();
+          mqttLinkLost = false;
+        } else {
+          mqttLinkLost = true;
+        }
       }
 
       // Process MQTT and sensor operations if connected
@@ -195,18 +292,38 @@ void handleWiFiStateMachine(unsigned long currentMillis) {
 
 void handleSensorOperations(unsigned long currentMillis) {
   ldrValue = analogRead(LDR_PIN);
-  isDark = ldrValue <= SUNLIGHT_THRESHOLD;
+  lightLevel = lightConverter.convert(ldrValue);
+  isDark = DecisionLogic::isDark(lightLevel);
+  traceRecorder.recordLight(lightLevel);
 
-  bool shouldSendData = justWokeUp || (!isDark && (currentMillis - lastDataSendTime >= LIGHT_SEND_INTERVAL));
+  bool shouldSendData = justWokeUp || (!isDark && (currentMillis - lastDataSendTime >= LIGHT_SEND_INTERVAL * powerMonitor.getStretch()));
 
   if (shouldSendData) {
+    // The tier is set from the reading taken before WiFi started; later sends may only drop it,
+    // so a pot that stays awake all day still reaches the saving tier (and then sleeps)
+    if (!justWokeUp && powerMonitor.sampleInSession()) {
+      wifiHandler.setTimeSyncEnabled(powerMonitor.allowsTimeSync());
+      traceRecorder.record(TRACE_POWER, powerMonitor.getMillivolts(), powerMonitor.getTier());
+      Serial.printf("Battery: %u mV, power tier dropped to %s\n", powerMonitor.getMillivolts(), powerMonitor.getTierName());
+    }
+
     lastDataSendTime = currentMillis;
     justWokeUp = false;
 
     // Read sensors
     temperatureSensor.requestTemperatures();
     temperature = temperatureSensor.getTempCByIndex(0);
-    moisture = analogRead(MOISTURE_PIN);
+    readMoisture();
+    traceRecorder.record(TRACE_SENSORS, moistureLevel, lightLevel);
+    traceRecorder.record(TRACE_TEMPERATURE, (int16_t)(temperature * 100));
+
+    // Update drying rate estimate (skips intervals that contained a watering)
+    unsigned long modelTime = rtcData.totalSleepTime + currentMillis;
+    bool watered = rtcData.lastWateringTime > dryingState.lastSampleTime;
+    dryingModel.addSample(modelTime, moistureLevel, temperature, watered);
+
+    // Store reading in on-device history
+    wifiHandler.history.addSample(moistureLevel, temperature, lightLevel);
 
     char dataBuffer[10];
 
@@ -219,58 +336,45 @@ void handleSensorOperations(unsigned long currentMillis) {
     // Send moisture
     itoa(moisture, dataBuffer, 10);
     wifiHandler.sendMoisture(dataBuffer);
+    dtostrf(moistureLevel / 10.0, 1, 1, dataBuffer);
+    wifiHandler.sendMoisturePercent(dataBuffer);
+
+    // Send light level
+    dtostrf(lightLevel / 10.0, 1, 1, dataBuffer);
+    wifiHandler.sendLightLux(dataBuffer);
 
     // Send sunlight presence
     dataBuffer[0] = isDark ? '0' : '1';
     dataBuffer[1] = '\0';
     wifiHandler.sendSunlightPresence(dataBuffer);
 
+    // Send battery voltage & power tier
+    dtostrf(powerMonitor.getMillivolts() / 1000.0, 1, 2, dataBuffer);
+    wifiHandler.sendPowerState(powerMonitor.isBatterySensed() ? dataBuffer : nullptr, powerMonitor.getTierName());
+
+    // Send memory/stack diagnostics
+    wifiHandler.sendDiagnostics();
+
     delay(1000);
   }
 }
 
 bool areAllTasksCompleted() {
-  unsigned long currentMillis = millis();
-
-  // Minimum awake time requirement
-  if (currentMillis - wakeupTime < 15000) {
-    return false;
-  }
-
-  // Must be dark, data sent after wakeup, and MQTT connected
-  if (!isDark || lastDataSendTime <= wakeupTime || !wifiHandler.client.connected()) {
-    return false;
-  }
-
-  // Track MQTT connection time for watering opportunity
-  static unsigned long mqttConnectedTime = 0;
-
-  if (mqttConnectedTime == 0) {
-    mqttConnectedTime = currentMillis;
-  }
-
-  // Give at least 10 seconds after MQTT connection for watering decision
-  if (currentMillis - mqttConnectedTime < 10000) {
-    return false;
-  }
-
-  return true;
+  return decisions.canSleep(millis(), wakeupTime, isDark, powerMonitor.staysAwakeInDaylight(),
+                            lastDataSendTime > wakeupTime, wifiHandler.client.connected());
 }
 
 void handleBuzzerAlerts(unsigned long currentMillis) {
   // Periodic moisture reading
   if (currentMillis - lastMoistureReading >= 5000) {
-    moisture = analogRead(MOISTURE_PIN);
+    readMoisture();
     lastMoistureReading = currentMillis;
   }
 
-  // Calculate time since last beep including sleep time
-  unsigned long timeSinceLastBeep = rtcData.totalSleepTime + currentMillis - rtcData.lastLowMoistureBeep;
-
-  // Trigger low moisture beep if needed
-  if (moisture < MOISTURE_THRESHOLD && timeSinceLastBeep >= LOW_MOISTURE_BEEP_INTERVAL) {
-    tone(BUZZER_PIN, LOW_MOISTURE_HZ, 200);
-    rtcData.lastLowMoistureBeep = rtcData.totalSleepTime + currentMillis;
+  // Trigger low moisture beep if needed, interval counted across sleep
+  if (decisions.shouldBeep(rtcData.totalSleepTime + currentMillis, moistureLevel, powerMonitor.allowsBuzzer())) {
+    buzzer.play(LOW_MOISTURE_BEEP);
+    traceRecorder.record(TRACE_BEEP, moistureLevel);
     Serial.println("Low moisture beep triggered");
   }
 }
@@ -282,57 +386,131 @@ void handleAutomation(unsigned long currentMillis) {
   }
 
   // Periodic moisture check and watering decision
-  static unsigned long lastMoistureCheck = 0;
-
-  if (currentMillis - lastMoistureCheck >= 2000) {
-    lastMoistureCheck = currentMillis;
-    moisture = analogRead(MOISTURE_PIN);
+  if (decisions.isWateringCheckDue(currentMillis)) {
+    readMoisture();
     lastMoistureReading = currentMillis;
 
     Serial.print("Automation - Moisture: ");
+    Serial.print(moistureLevel / 10.0, 1);
+    Serial.print("% (raw ");
     Serial.print(moisture);
-    Serial.print(" | Threshold: ");
-    Serial.print(MOISTURE_THRESHOLD);
-    Serial.print(" | Dry: ");
-    Serial.println(moisture < MOISTURE_THRESHOLD ? "YES" : "NO");
-
-    // Check if watering is needed
-    if (moisture < MOISTURE_THRESHOLD) {
-      unsigned long timeSinceLastWatering = rtcData.totalSleepTime + millis() - rtcData.lastWateringTime;
-
-      if (timeSinceLastWatering >= WATERING_COOLDOWN) {
+    Serial.print(") | Threshold: ");
+    Serial.print(MOISTURE_THRESHOLD_PERCENT, 1);
+    Serial.print("% | Dry: ");
+    Serial.println(DecisionLogic::isSoilDry(moistureLevel) ? "YES" : "NO");
+
+    // Check if watering is needed, cooldown counted across sleep
+    unsigned long now = rtcData.totalSleepTime + currentMillis;
+    if (DecisionLogic::isSoilDry(moistureLevel)) {
+      if (decisions.shouldWater(now, moistureLevel)) {
         // Trigger watering sequence
         wifiHandler.sendWaterCommand();
+        traceRecorder.record(TRACE_WATER, moistureLevel);
 
         String timestamp = wifiHandler.getCurrentTimestamp();
         wifiHandler.sendLastWateringTime(timestamp.c_str());
 
         Serial.print("Watering triggered at: ");
         Serial.println(timestamp);
+        wifiHandler.history.addSample(moistureLevel, temperature, lightLevel, 1);
 
         wateringStartTime = millis();
-        rtcData.lastWateringTime = rtcData.totalSleepTime + millis();
-
-        // Reset the low moisture beep timer when watering occurs
-        rtcData.lastLowMoistureBeep = rtcData.totalSleepTime + millis();
         Serial.println("Low moisture beep timer reset after watering");
 
         delay(500);  // Ensure MQTT messages are sent
       } else {
-        unsigned long cooldownRemaining = (WATERING_COOLDOWN - timeSinceLastWatering) / 1000;
         Serial.print("Soil is dry but watering is in cooldown. Next watering in: ");
-        Serial.print(cooldownRemaining);
+        Serial.print(decisions.cooldownRemaining(now) / 1000);
         Serial.println("s");
       }
     }
   }
 }
 
+void readMoisture() {
+  moisture = analogRead(MOISTURE_PIN);
+  moistureLevel = moistureConverter.convert(moisture);
+  traceRecorder.recordMoisture(moistureLevel, moisture);
+}
+
+// 't' dumps the decision trace, 'c' clears it
+void handleSerialCommands() {
+  while (Serial.available()) {
+    char command = Serial.read();
+    if (command == 't') {
+      traceRecorder.dump(Serial);
+    } else if (command == 'c') {
+      traceRecorder.clear();
+      Serial.println("Trace cleared");
+    }
+  }
+}
+
+// Pick the LED blink code for the current WiFi/MQTT/watering state
+void updateStatusLeds(unsigned long currentMillis) {
+  if (wateringStartTime != 0 && currentMillis - wateringStartTime < WATERING_INDICATION_TIME) {
+    statusLeds.loop(LED_WATERING);
+    return;
+  }
+
+  switch (currentWiFiState) {
+    case WIFI_SETUP_MODE:
+      statusLeds.loop(LED_SETUP_MODE);
+      break;
+    case WIFI_CONNECTING:
+      statusLeds.loop(LED_CONNECTING);
+      break;
+    case WIFI_CONNECTED:
+      if (wifiHandler.client.connected()) {
+        statusLeds.loop(LED_CONNECTED);
+      } else {
+        statusLeds.loop(LED_MQTT_DOWN);
+      }
+      break;
+    case WIFI_FAILED:
+      statusLeds.loop(LED_WIFI_FAILED);
+      break;
+  }
+}
+
+void writeBuzzer(uint16_t frequency) {
+  if (frequency > 0) {
+    tone(BUZZER_PIN, frequency);
+  } else {
+    noTone(BUZZER_PIN);
+  }
+}
+
+// Only touches pins that have an LED configured
+void writeStatusLeds(uint16_t leds) {
+  if (RED_LED_PIN >= 0) digitalWrite(RED_LED_PIN, (leds & LED_RED) ? HIGH : LOW);
+  if (GREEN_LED_PIN >= 0) digitalWrite(GREEN_LED_PIN, (leds & LED_GREEN) ? HIGH : LOW);
+}
+
 void goToDeepSleep() {
   Serial.println("Going to deep sleep...");
 
+  buzzer.stop();
+  statusLeds.stop();
+
   isWatering = false;
-  esp_sleep_enable_timer_wakeup(DARK_SEND_INTERVAL);
+
+  // Sleep until the soil is predicted to need attention, longer on a low battery
+  rtcData.lastSleepDuration = decisions.sleepTime(dryingModel, moistureLevel, temperature, powerMonitor.getStretch());
+  Serial.print("Sleeping for ");
+  Serial.print(rtcData.lastSleepDuration / 1000);
+  Serial.println("s");
+  traceRecorder.record(TRACE_SLEEP, rtcData.lastSleepDuration / 1000);
+  esp_sleep_enable_timer_wakeup((uint64_t)rtcData.lastSleepDuration * 1000ULL);
+
+  // Empty the trace ring to the broker, so field traces span days instead of what fits in RTC memory.
+  // Without the broker it keeps filling and goes out on a later wake.
+  if (wifiHandler.client.connected()) {
+    traceRecorder.flush([](const char* chunk) {
+      return wifiHandler.sendTraceChunk(chunk);
+    });
+    wifiHandler.client.disconnect();  // Clean close so the last chunks leave before the radio goes off
+  }
 
   WiFi.disconnect();
   WiFi.mode(WIFI_OFF);
@@ -0,0 +1,131 @@
+#pragma once
+
+// Decision trace: inputs (sensors, connectivity, wake) and outputs (water, beep, sleep)
+// on the sleep-adjusted clock, so a run can be replayed and compared offline.
+enum TraceEvent : uint8_t {
+  TRACE_WAKE,         // a = cold boot (1/0), b = wakeup cause
+  TRACE_SENSORS,      // a = moisture (0.1 %), b = light (0.1 lux)
+  TRACE_TEMPERATURE,  // a = temperature (0.01 C)
+  TRACE_MOISTURE,     // a = moisture (0.1 %), b = raw ADC; logged on change and on crossing the dry threshold
+  TRACE_WIFI_UP,
+  TRACE_WIFI_DOWN,
+  TRACE_MQTT_UP,
+  TRACE_MQTT_DOWN,
+  TRACE_WATER,        // a = moisture (0.1 %)
+  TRACE_BEEP,         // a = moisture (0.1 %)
+  TRACE_SLEEP,        // a = scheduled sleep (s)
+  TRACE_POWER,        // a = battery (mV), b = power tier
+  TRACE_LIGHT,        // a = light (0.1 lux); logged when day/night flips
+  TRACE_CONFIG,       // a = moisture threshold (0.01 %), b = sunlight threshold (0.1 lux)
+  TRACE_EVENT_COUNT
+};
+
+struct TraceEntry {
+  uint32_t time;  // ms, rtcData.totalSleepTime + millis()
+  int16_t a;
+  int16_t b;
+  uint8_t event;
+};
+
+// Ring buffer in RTC memory so a trace spans many sleep cycles
+RTC_DATA_ATTR struct {
+  uint16_t head = 0;
+  uint16_t count = 0;
+  uint32_t dropped = 0;
+  TraceEntry entries[TRACE_CAPACITY];
+} traceBuffer;
+
+class TraceRecorder {
+private:
+  int16_t lastMoisture;
+  int16_t lastLight;
+
+public:
+  TraceRecorder()
+    : lastMoisture(INT16_MIN),
+      lastLight(INT16_MIN) {}
+
+  static inline const char* eventName(uint8_t event) {
+    static const char* const NAMES[TRACE_EVENT_COUNT] = {
+      "WAKE", "SENSORS", "TEMPERATURE", "MOISTURE", "WIFI_UP", "WIFI_DOWN",
+      "MQTT_UP", "MQTT_DOWN", "WATER", "BEEP", "SLEEP", "POWER", "LIGHT", "CONFIG"
+    };
+    return event < TRACE_EVENT_COUNT ? NAMES[event] : "UNKNOWN";
+  }
+
+  void record(TraceEvent event, int16_t a = 0, int16_t b = 0) {
+    // Oldest entry is overwritten when full
+    if (traceBuffer.count == TRACE_CAPACITY) {
+      traceBuffer.dropped++;
+    } else {
+      traceBuffer.count++;
+    }
+    traceBuffer.entries[traceBuffer.head] = { (uint32_t)(rtcData.totalSleepTime + millis()), a, b, (uint8_t)event };
+    traceBuffer.head = (traceBuffer.head + 1) % TRACE_CAPACITY;
+  }
+
+  // Only log moisture when it moved enough to matter or changed the dry decision, keeps the ring from flooding
+  void recordMoisture(int moistureLevel, int raw) {
+    if (lastMoisture != INT16_MIN && abs(moistureLevel - lastMoisture) < TRACE_MOISTURE_DELTA
+        && DecisionLogic::isSoilDry(moistureLevel) == DecisionLogic::isSoilDry(lastMoisture)) {
+      return;
+    }
+    lastMoisture = moistureLevel;
+    record(TRACE_MOISTURE, moistureLevel, raw);
+  }
+
+  // Light is read every loop, only day/night flips matter to the decisions
+  void recordLight(int lightLevel) {
+    if (lastLight != INT16_MIN && DecisionLogic::isDark(lightLevel) == DecisionLogic::isDark(lastLight)) return;
+    lastLight = lightLevel;
+    record(TRACE_LIGHT, lightLevel);
+  }
+
+  void recordConfig() {
+    record(TRACE_CONFIG, MOISTURE_THRESHOLD_PERCENT * 100, SUNLIGHT_THRESHOLD_LUX * 10);
+  }
+
+  // CSV dump, oldest first
+  void dump(Print& out) const {
+    out.println("# smart-pot trace v2");
+    out.print("# dropped ");
+    out.println(traceBuffer.dropped);
+    out.println("# time_ms,event,a,b");
+
+    uint16_t start = (traceBuffer.head + TRACE_CAPACITY - traceBuffer.count) % TRACE_CAPACITY;
+    for (uint16_t i = 0; i < traceBuffer.count; i++) {
+      const TraceEntry& entry = traceBuffer.entries[(start + i) % TRACE_CAPACITY];
+      out.printf("%lu,%s,%d,%d\n", (unsigned long)entry.time, eventName(entry.event), entry.a, entry.b);
+    }
+    out.println("# end");
+  }
+
+  // Hands the oldest entries to 'send' as CSV chunks of TRACE_FLUSH_ENTRIES lines, forgetting each chunk
+  // once sent. A refused chunk stays in the ring for the next flush. Chunks concatenate into a dump.
+  template<typename Send>
+  void flush(Send send) {
+    char chunk[TRACE_FLUSH_ENTRIES * 40 + 24];
+    while (traceBuffer.count > 0) {
+      uint16_t start = (traceBuffer.head + TRACE_CAPACITY - traceBuffer.count) % TRACE_CAPACITY;
+      uint16_t lines = traceBuffer.count < TRACE_FLUSH_ENTRIES ? traceBuffer.count : TRACE_FLUSH_ENTRIES;
+
+      size_t used = 0;
+      if (traceBuffer.dropped) used += snprintf(chunk, sizeof(chunk), "# dropped %lu\n", (unsigned long)traceBuffer.dropped);
+      for (uint16_t i = 0; i < lines; i++) {
+        const TraceEntry& entry = traceBuffer.entries[(start + i) % TRACE_CAPACITY];
+        used += snprintf(chunk + used, sizeof(chunk) - used, "%lu,%s,%d,%d\n",
+                         (unsigned long)entry.time, eventName(entry.event), entry.a, entry.b);
+      }
+      if (!send(chunk)) return;
+
+      traceBuffer.count -= lines;
+      traceBuffer.dropped = 0;
+    }
+  }
+
+  void clear() {
+    traceBuffer.head = 0;
+    traceBuffer.count = 0;
+    traceBuffer.dropped = 0;
+  }
+};
@@ -5,43 +5,83 @@
 #include <DNSServer.h>
 #include <WebServer.h>
 #include "html.h"
+#include "diagnostics.h"
+#include "history-store.h"
+#include "ota-updater.h"
+#include "session-client.h"
 
 class WifiHandler {
 private:
   unsigned long apStartTime;
+  unsigned long mqttConnectStart;
+  bool awaitingFirstPublish;
   bool apModeActive;
   bool credentialsSaved;
   bool initialSetup;
+  bool timeSyncEnabled;
   String savedSSID;
   String savedPassword;
+  String pendingUpdateUrl;
 
   // Helper function for MQTT publishing
   inline bool publishMQTT(const char* topic, const char* payload, bool retain = false) {
     if (client.connected()) {
       bool result = client.publish(topic, payload, retain);
       client.loop();
+      if (!result) diagnostics.countPublishFailure();
+
+      // Connect-to-first-publish time of this session
+      if (result && awaitingFirstPublish) {
+        awaitingFirstPublish = false;
+        diagnostics.setConnectToPublishTime(millis() - mqttConnectStart);
+        ota.confirm();  // Reaching the broker proves a freshly updated image works
+        Serial.print("MQTT: first publish ");
+        Serial.print(millis() - mqttConnectStart);
+        Serial.println(" ms after connect start");
+      }
       return result;
     }
+    diagnostics.countPublishFailure();
     return false;
   }
 
+  // Incoming MQTT messages, handled later from loop()
+  void onMessage(char* topic, uint8_t* payload, unsigned int length) {
+    if (strcmp(topic, MQTT_TOPIC_OTA) == 0 && length > 0) {
+      pendingUpdateUrl = String((const char*)payload, length);
+      Serial.println("MQTT: update requested from " + pendingUpdateUrl);
+    }
+  }
+
 public:
   // Instances
   WiFiClient espClient;
+  SessionClient sessionClient;
   PubSubClient client;
   Preferences preferences;
   DNSServer dnsServer;
   WebServer server;
+  Diagnostics diagnostics;
+  HistoryStore history;
+  OtaUpdater ota;
   struct tm localTime;
 
   // Constructor with member initializer list
   WifiHandler()
-    : client(espClient),
+    : sessionClient(espClient),
+      client(sessionClient),
       server(80),
       apStartTime(0),
+      mqttConnectStart(0),
+      awaitingFirstPublish(false),
       apModeActive(false),
       credentialsSaved(false),
-      initialSetup(true) {}
+      initialSetup(true),
+      timeSyncEnabled(true) {
+    client.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+      onMessage(topic, payload, length);
+    });
+  }
 
   // --------------------------------------------------------------------------
   // ------------------------- GETTER FUNCTIONS -------------------------------
@@ -55,6 +95,9 @@ public:
   inline bool areCredentialsSaved() const {
     return credentialsSaved;
   }
+  inline bool hasPendingUpdate() const {
+    return !pendingUpdateUrl.isEmpty();
+  }
 
   // --------------------------------------------------------------------------
   // ------------------------- SETTER FUNCTIONS -------------------------------
@@ -65,6 +108,9 @@ public:
   inline void setInitialSetup(bool newInitialSetup) {
     initialSetup = newInitialSetup;
   }
+  inline void setTimeSyncEnabled(bool enabled) {
+    timeSyncEnabled = enabled;
+  }
 
   // --------------------------------------------------------------------------
   // ------------------------- MQTT FUNCTIONS ---------------------------------
@@ -72,14 +118,30 @@ public:
 
   void reconnectMQTT() {
     if (WiFi.status() != WL_CONNECTED) return;
+    mqttConnectStart = millis();
 
     // Attempt MQTT connection with retry logic
     for (int attempts = 0; attempts < MQTT_RECONNECT_ATTEMPTS && !client.connected(); attempts++) {
-      String clientId = "water_station_" + String(random(0xffff), HEX);
+      bool connected;
+      if (MQTT_PERSISTENT_SESSION) {
+        // Stable ID per device, cleanSession=false keeps subscriptions and queued QoS 1 messages
+        char clientId[24];
+        snprintf(clientId, sizeof(clientId), "smart_pot_%06lx", (unsigned long)((ESP.getEfuseMac() >> 24) & 0xFFFFFF));
+        connected = client.connect(clientId, MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str(), nullptr, 0, false, nullptr, false);
+      } else {
+        String clientId = "smart_pot_" + String(random(0xffff), HEX);
+        connected = client.connect(clientId.c_str(), MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str());
+      }
+
+      if (connected) {
+        awaitingFirstPublish = true;
 
-      if (client.connect(clientId.c_str(), MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str())) {
-        if (client.subscribe(MQTT_TOPIC_WATER_COMMAND)) {
-          Serial.println("MQTT subscribed to: " + String(MQTT_TOPIC_WATER_COMMAND));
+        // Broker lost the session (restart without persistence, expiry, new account): subscribe again
+        bool resubscribe = !MQTT_PERSISTENT_SESSION || !sessionClient.isSessionPresent();
+        if (resubscribe && client.subscribe(MQTT_TOPIC_WATER_COMMAND, 1) && client.subscribe(MQTT_TOPIC_OTA, 1)) {
+          Serial.println("MQTT subscribed to: " + String(MQTT_TOPIC_WATER_COMMAND) + ", " + String(MQTT_TOPIC_OTA));
+        } else if (!resubscribe) {
+          Serial.println("MQTT session resumed, skipping subscribe");
         }
         return;
       }
@@ -116,12 +178,21 @@ public:
     publishMQTT(MQTT_TOPIC_SOIL_MOISTURE, buffer);
   }
 
+  inline void sendMoisturePercent(const char* buffer) {
+    publishMQTT(MQTT_TOPIC_SOIL_MOISTURE_PERCENT, buffer);
+  }
+
+  inline void sendLightLux(const char* buffer) {
+    publishMQTT(MQTT_TOPIC_LIGHT_LUX, buffer);
+  }
+
   inline void sendSunlightPresence(const char* buffer) {
     publishMQTT(MQTT_TOPIC_SUNLIGHT_PRESENCE, buffer);
   }
 
   void sendWaterCommand() {
     if (publishMQTT(MQTT_TOPIC_WATER_COMMAND, WATERING_CODE)) {
+      diagnostics.countWateringCommand();
       Serial.println("MQTT: Watering command sent");
     } else {
       Serial.println("MQTT: Not connected, cannot send watering command");
@@ -137,6 +208,48 @@ public:
     }
   }
 
+  // Battery voltage (nullptr = not sensed) and power tier, retained so the last state survives a brownout
+  void sendPowerState(const char* voltage, const char* tier) {
+    if (voltage) publishMQTT(MQTT_TOPIC_BATTERY_VOLTAGE, voltage, true);
+    publishMQTT(MQTT_TOPIC_POWER_TIER, tier, true);
+  }
+
+  // One chunk of the decision trace, not retained: a subscriber appends the chunks to a file
+  inline bool sendTraceChunk(const char* csv) {
+    return publishMQTT(MQTT_TOPIC_TRACE, csv);
+  }
+
+  // Sample heap/stack and publish a retained snapshot with the event counters
+  void sendDiagnostics() {
+    char diagBuffer[200];
+    diagnostics.sample();
+    diagnostics.toJson(diagBuffer, sizeof(diagBuffer));
+    publishMQTT(MQTT_TOPIC_DIAGNOSTICS, diagBuffer, true);
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- OTA FUNCTIONS ----------------------------------
+  // --------------------------------------------------------------------------
+
+  // Apply the requested update, report the result and reboot into the new image on success
+  void runPendingUpdate() {
+    String url = pendingUpdateUrl;
+    pendingUpdateUrl = "";
+
+    bool updated = ota.update(url);
+
+    char statusBuffer[200];
+    ota.toJson(statusBuffer, sizeof(statusBuffer), "pot");
+    publishMQTT(MQTT_TOPIC_OTA_STATUS, statusBuffer);
+
+    if (updated) {
+      Serial.println("OTA: restarting into new image");
+      client.disconnect();
+      delay(500);
+      ESP.restart();
+    }
+  }
+
   String getCurrentTimestamp() {
     struct tm timeinfo;
 
@@ -156,6 +269,37 @@ public:
   // --------------------- FLASH MEMORY FUNCTIONS -----------------------------
   // --------------------------------------------------------------------------
 
+  void loadCalibration() {
+    preferences.begin("calib", true);
+    MOISTURE_THRESHOLD_PERCENT = preferences.getFloat("moist_thr", MOISTURE_THRESHOLD_PERCENT);
+    SUNLIGHT_THRESHOLD_LUX = preferences.getFloat("light_thr", SUNLIGHT_THRESHOLD_LUX);
+    MOISTURE_CAL_LOW_RAW = preferences.getInt("moist_low", MOISTURE_CAL_LOW_RAW);
+    MOISTURE_CAL_HIGH_RAW = preferences.getInt("moist_high", MOISTURE_CAL_HIGH_RAW);
+    preferences.end();
+
+    Serial.print("Thresholds: ");
+    Serial.print(MOISTURE_THRESHOLD_PERCENT);
+    Serial.print(" % / ");
+    Serial.print(SUNLIGHT_THRESHOLD_LUX);
+    Serial.println(" lux");
+  }
+
+  void saveCalibration(float moistureThreshold, float sunlightThreshold, int calLowRaw, int calHighRaw) {
+    preferences.begin("calib", false);
+    preferences.putFloat("moist_thr", moistureThreshold);
+    preferences.putFloat("light_thr", sunlightThreshold);
+    preferences.putInt("moist_low", calLowRaw);
+    preferences.putInt("moist_high", calHighRaw);
+    preferences.end();
+
+    MOISTURE_THRESHOLD_PERCENT = moistureThreshold;
+    SUNLIGHT_THRESHOLD_LUX = sunlightThreshold;
+    MOISTURE_CAL_LOW_RAW = calLowRaw;
+    MOISTURE_CAL_HIGH_RAW = calHighRaw;
+
+    Serial.println("Calibration saved");
+  }
+
   bool loadWiFiCredentials() {
     preferences.begin("wifi", true);
     savedSSID = preferences.getString("ssid", "");
@@ -250,6 +394,11 @@ public:
       html.replace("%MQTT_PORT%", String(MQTT_SERVER_PORT));
       html.replace("%MQTT_USER%", MQTT_USERNAME);
       html.replace("%MQTT_PASS%", MQTT_PASSWORD);
+      html.replace("%MOISTURE_THRESHOLD%", String(MOISTURE_THRESHOLD_PERCENT, 1));
+      html.replace("%SUNLIGHT_THRESHOLD%", String(SUNLIGHT_THRESHOLD_LUX, 0));
+      html.replace("%MOISTURE_CAL_LOW%", String(MOISTURE_CAL_LOW_RAW));
+      html.replace("%MOISTURE_CAL_HIGH%", String(MOISTURE_CAL_HIGH_RAW));
+      html.replace("%MOISTURE_RAW%", String(analogRead(MOISTURE_PIN)));
       server.send(200, "text/html", html);
     });
 
@@ -270,8 +419,20 @@ public:
         return;
       }
 
+      // Optional thresholds & calibration, keep current values when left empty
+      float moistureThreshold = server.arg("moisture_threshold").isEmpty() ? MOISTURE_THRESHOLD_PERCENT : server.arg("moisture_threshold").toFloat();
+      float sunlightThreshold = server.arg("sunlight_threshold").isEmpty() ? SUNLIGHT_THRESHOLD_LUX : server.arg("sunlight_threshold").toFloat();
+      int calLowRaw = server.arg("moisture_cal_low").isEmpty() ? MOISTURE_CAL_LOW_RAW : server.arg("moisture_cal_low").toInt();
+      int calHighRaw = server.arg("moisture_cal_high").isEmpty() ? MOISTURE_CAL_HIGH_RAW : server.arg("moisture_cal_high").toInt();
+
+      if (moistureThreshold < 0 || moistureThreshold > 100 || sunlightThreshold < 0 || sunlightThreshold > SUNLIGHT_THRESHOLD_MAX_LUX || calLowRaw < 0 || calLowRaw > 4095 || calHighRaw < 0 || calHighRaw > 4095) {
+        server.send(400, "text/plain", "Invalid calibration");
+        return;
+      }
+
       // Save configuration and send success response
       saveConfiguration(wifiSSID, wifiPassword, mqttServer, port, mqttUser, mqttPass);
+      saveCalibration(moistureThreshold, sunlightThreshold, calLowRaw, calHighRaw);
 
       // Send a simple success response
       server.sendHeader("Connection", "close");
@@ -281,6 +442,70 @@ public:
       credentialsSaved = true;
     });
 
+    // Runtime memory and counter metrics
+    server.on("/metrics", HTTP_GET, [this]() {
+      char metricsBuffer[400];
+      diagnostics.sample();
+      diagnostics.toMetrics(metricsBuffer, sizeof(metricsBuffer));
+      server.send(200, "text/plain", metricsBuffer);
+    });
+
+    // Stored history: /history?tier=raw|15m|1h&from=<epoch>&to=<epoch>&format=csv|bin
+    server.on("/history", HTTP_GET, [this]() {
+      if (!history.isAvailable()) {
+        server.send(503, "text/plain", "History unavailable");
+        return;
+      }
+
+      HistoryTier tier = HISTORY_RAW;
+      if (server.arg("tier") == "15m") tier = HISTORY_15MIN;
+      else if (server.arg("tier") == "1h") tier = HISTORY_HOURLY;
+
+      uint32_t from = server.hasArg("from") ? strtoul(server.arg("from").c_str(), nullptr, 10) : 0;
+      uint32_t to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), nullptr, 10) : UINT32_MAX;
+      bool binary = server.arg("format") == "bin";
+
+      // Stream in small chunks, the response is never built in RAM
+      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server.send(200, binary ? "application/octet-stream" : "text/csv", "");
+      if (!binary) server.sendContent("timestamp,moisture_percent,temperature_c,light_lux,waterings,samples\n");
+
+      char chunk[512];
+      size_t used = 0;
+      history.query(tier, from, to, [&](const HistoryRecord& record) {
+        if (binary) {
+          memcpy(chunk + used, &record, sizeof(record));
+          used += sizeof(record);
+        } else {
+          char temperatureText[8] = "";
+          if (record.temperature != HISTORY_NO_TEMPERATURE) {
+            snprintf(temperatureText, sizeof(temperatureText), "%.2f", record.temperature / 100.0);
+          }
+          used += snprintf(chunk + used, sizeof(chunk) - used, "%lu,%u.%u,%s,%u.%u,%u,%u\n",
+                           (unsigned long)record.timestamp, record.moisture / 10, record.moisture % 10, temperatureText,
+                           record.light / 10, record.light % 10, record.waterings, record.samples);
+        }
+        if (used > sizeof(chunk) - 64) {
+          server.sendContent(chunk, used);
+          used = 0;
+        }
+      });
+      if (used > 0) server.sendContent(chunk, used);
+      server.sendContent("");
+    });
+
+    // Firmware update from a URL reachable by the pot (e.g. a laptop on the portal network)
+    server.on("/update", HTTP_POST, [this]() {
+      String url = server.arg("url");
+      if (!url.startsWith("http://")) {
+        server.send(400, "text/plain", "Invalid update URL");
+        return;
+      }
+      server.sendHeader("Connection", "close");
+      server.send(202, "text/plain", "Updating");
+      pendingUpdateUrl = url;
+    });
+
     // CORS preflight
     server.on("/config", HTTP_OPTIONS, [this]() {
       server.sendHeader("Access-Control-Allow-Origin", "*");
@@ -334,7 +559,8 @@ public:
       Serial.println(WiFi.localIP());
 
       client.setServer(MQTT_SERVER_IP.c_str(), MQTT_SERVER_PORT);
-      configTime(3600, 3600, NTP_SERVER_URL);
+      client.setKeepAlive(MQTT_KEEPALIVE);
+      if (timeSyncEnabled) configTime(3600, 3600, NTP_SERVER_URL);
       return true;
     }
 
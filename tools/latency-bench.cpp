@@ -0,0 +1,122 @@
+// Host benchmark for the water station's latency histogram.
+// Feeds synthetic loop and button-press timings and checks the reported p99 against the exact one.
+// Given a file of recorded smartpot/station_latency messages, also checks every minute's p99 against the budgets.
+//
+//   g++ -std=c++11 -O2 -I v4/water-station-code tools/latency-bench.cpp -o latency-bench && ./latency-bench
+//   mosquitto_sub -t smartpot/station_latency > latency.log   # on the broker, for a day or so
+//   ./latency-bench latency.log
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "latency-histogram.h"
+
+// Budgets for the station's loop (see water-station-code.ino)
+const uint32_t LOOP_WORK_P99_BUDGET = 2000;     // us of work per iteration, excluding the idle delay
+const uint32_t BUTTON_P99_BUDGET = 131072;      // us, one 100 ms poll period plus work, rounded to the bucket
+const uint32_t LOOP_POLL_PERIOD = 100000;       // us, delay(100) in loop()
+
+static int failures = 0;
+
+static uint32_t exactPercentile(std::vector<uint32_t> samples, int pct) {
+  std::sort(samples.begin(), samples.end());
+  size_t rank = (samples.size() * pct + 99) / 100;
+  return samples[rank ? rank - 1 : 0];
+}
+
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+// Histogram p99 must bracket the exact p99 within one log2 bucket
+static void verify(const char* name, const std::vector<uint32_t>& samples) {
+  LatencyHistogram histogram;
+  for (uint32_t sample : samples) histogram.record(sample);
+
+  uint32_t exact = exactPercentile(samples, 99);
+  uint32_t reported = histogram.percentile(99);
+  printf("%-8s n=%zu p50=%luus p99=%luus (exact %luus) max=%luus\n", name, samples.size(),
+         (unsigned long)histogram.percentile(50), (unsigned long)reported, (unsigned long)exact,
+         (unsigned long)histogram.getMax());
+
+  check(histogram.getCount() == samples.size(), "sample count");
+  check(reported >= exact, "p99 below exact p99");
+  check(reported <= exact * 2 + 1, "p99 more than one bucket above exact p99");
+}
+
+// Per-minute p99 from recorded {"loop":[p50,p99,max],"button":[...],"mqtt":[...]} lines, 0 = no samples that minute
+static void verifyRecorded(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    printf("FAIL: can't open %s\n", path);
+    failures++;
+    return;
+  }
+
+  struct {
+    const char* name;
+    const char* key;
+    uint32_t budget;
+    unsigned long minutes;
+    unsigned long over;
+    unsigned long worst;
+  } series[] = {
+    { "loop", "\"loop\":[", LOOP_WORK_P99_BUDGET, 0, 0, 0 },
+    { "button", "\"button\":[", BUTTON_P99_BUDGET, 0, 0, 0 },
+  };
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    for (auto& s : series) {
+      const char* field = strstr(line, s.key);
+      unsigned long p50, p99;
+      if (!field || sscanf(field + strlen(s.key), "%lu,%lu", &p50, &p99) != 2 || p99 == 0) continue;
+      s.minutes++;
+      if (p99 > s.budget) s.over++;
+      s.worst = std::max(s.worst, p99);
+    }
+  }
+  fclose(file);
+
+  for (auto& s : series) {
+    printf("recorded %-8s %lu minute(s), worst p99=%luus, %lu over the %luus budget\n", s.name, s.minutes, s.worst,
+           s.over, (unsigned long)s.budget);
+    check(s.over == 0, "recorded p99 over budget");
+  }
+  check(series[0].minutes > 0, "no recorded loop latency lines");
+}
+
+int main(int argc, char** argv) {
+  std::mt19937 rng(12345);
+
+  // Loop work: mostly 150-600 us, 0.5 % MQTT/WiFi housekeeping spikes up to 1.5 ms
+  std::vector<uint32_t> loop;
+  std::uniform_int_distribution<uint32_t> work(150, 600);
+  std::uniform_int_distribution<uint32_t> spike(800, 1500);
+  std::uniform_real_distribution<double> chance(0, 1);
+  for (int i = 0; i < 100000; i++) loop.push_back(chance(rng) < 0.005 ? spike(rng) : work(rng));
+  verify("loop", loop);
+
+  // Button: edge lands anywhere in the poll period, pump starts on the next poll after the loop work
+  std::vector<uint32_t> button;
+  std::uniform_int_distribution<uint32_t> phase(0, LOOP_POLL_PERIOD - 1);
+  for (int i = 0; i < 10000; i++) button.push_back(LOOP_POLL_PERIOD - phase(rng) + work(rng));
+  verify("button", button);
+
+  // Edge cases: empty histogram and a single sample
+  LatencyHistogram empty;
+  check(empty.percentile(99) == 0, "empty p99");
+  LatencyHistogram single;
+  single.record(42);
+  check(single.percentile(99) == 42, "single-sample p99");
+
+  // Budgets are only checked against the station's own numbers
+  if (argc > 1) verifyRecorded(argv[1]);
+
+  printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
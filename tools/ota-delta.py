@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Build signed OTA deltas and images for the pot and station, and serve them on the local network.
+
+  OTA_KEY=<secret> ota-delta.py make <running.bin> <new.bin> <out.delta>
+  OTA_KEY=<secret> ota-delta.py sign <new.bin> <out.bin>
+  ota-delta.py serve [directory] [port]
+
+The delta format is described in smart-pot-code/ota-updater.h. <running.bin> must be
+the exact image the device is running, the device refuses deltas built for anything else.
+OTA_KEY must match the one compiled into the device, unsigned updates are refused.
+"""
+import hashlib
+import hmac
+import http.server
+import os
+import struct
+import sys
+import time
+import zlib
+
+BLOCK = 32  # Shortest match worth a COPY op (9 bytes)
+HASH_APPENDED_OFFSET = 23  # esp_image_header_t.hash_appended
+
+
+def image_digest(image):
+    """SHA-256 as esp_partition_get_sha256() reports it for a running app.
+
+    Exported images end with a SHA-256 of everything before it, and that
+    appended digest (not a hash of the whole file) is what the device
+    returns. Images without one are hashed whole.
+    """
+    if (len(image) > HASH_APPENDED_OFFSET + 32 and image[HASH_APPENDED_OFFSET] == 1
+            and hashlib.sha256(image[:-32]).digest() == image[-32:]):
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def make_delta(source, target):
+    # Index the source at 4 byte steps, firmware sections are word aligned
+    index = {}
+    for offset in range(0, len(source) - BLOCK + 1, 4):
+        index.setdefault(source[offset:offset + BLOCK], offset)
+
+    ops = []
+    literal = bytearray()
+    position = 0
+    while position < len(target):
+        offset = index.get(target[position:position + BLOCK])
+        if offset is None:
+            literal.append(target[position])
+            position += 1
+            continue
+
+        length = BLOCK
+        while (position + length < len(target) and offset + length < len(source)
+               and target[position + length] == source[offset + length]):
+            length += 1
+
+        if literal:
+            ops.append(b"\x02" + struct.pack("<I", len(literal)) + bytes(literal))
+            literal = bytearray()
+        ops.append(b"\x01" + struct.pack("<II", offset, length))
+        position += length
+
+    if literal:
+        ops.append(b"\x02" + struct.pack("<I", len(literal)) + bytes(literal))
+    ops.append(b"\x00")
+
+    # Target hash covers every byte written, appended digest included
+    hashes = struct.pack("<I", len(target)) + image_digest(source) + hashlib.sha256(target).digest()
+    ops = b"".join(ops)
+    compressed = zlib.compress(ops, 9)
+    if len(compressed) < len(ops):
+        return b"SPZ1" + hashes + compressed
+    return b"SPD1" + hashes + ops
+
+
+def sign(data, key):
+    return data + hmac.new(key, data, hashlib.sha256).digest()
+
+
+def signing_key():
+    key = os.environ.get("OTA_KEY", "")
+    if not key:
+        sys.exit("OTA_KEY is not set, use the key from config.h")
+    return key.encode()
+
+
+def make(source_path, target_path, out_path):
+    with open(source_path, "rb") as f:
+        source = f.read()
+    with open(target_path, "rb") as f:
+        target = f.read()
+
+    key = signing_key()
+    start = time.time()
+    delta = sign(make_delta(source, target), key)
+    with open(out_path, "wb") as f:
+        f.write(delta)
+
+    print("full image  %8d bytes" % len(target))
+    print("delta       %8d bytes (%.1f %% of full, %s, built in %.1f s)"
+          % (len(delta), 100.0 * len(delta) / len(target),
+             "compressed" if delta.startswith(b"SPZ1") else "uncompressed", time.time() - start))
+
+
+def sign_image(image_path, out_path):
+    with open(image_path, "rb") as f:
+        image = f.read()
+    with open(out_path, "wb") as f:
+        f.write(sign(image, signing_key()))
+    print("signed image %8d bytes" % len(image))
+
+
+class UpdateHandler(http.server.SimpleHTTPRequestHandler):
+    # Log transfer size and time per download, to compare delta and full updates
+    def do_GET(self):
+        start = time.time()
+        super().do_GET()
+        path = self.translate_path(self.path)
+        if os.path.isfile(path):
+            print("%s %s: %d bytes in %.2f s" % (self.client_address[0], self.path,
+                                                 os.path.getsize(path), time.time() - start))
+
+
+def serve(directory, port):
+    os.chdir(directory)
+    print("Serving %s on port %d" % (os.getcwd(), port))
+    http.server.ThreadingHTTPServer(("", port), UpdateHandler).serve_forever()
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 5 and sys.argv[1] == "make":
+        make(sys.argv[2], sys.argv[3], sys.argv[4])
+    elif len(sys.argv) == 4 and sys.argv[1] == "sign":
+        sign_image(sys.argv[2], sys.argv[3])
+    elif len(sys.argv) in (2, 3, 4) and sys.argv[1] == "serve":
+        serve(sys.argv[2] if len(sys.argv) > 2 else ".", int(sys.argv[3]) if len(sys.argv) > 3 else 8000)
+    else:
+        print(__doc__)
+        sys.exit(1)
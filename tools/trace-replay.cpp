@@ -0,0 +1,320 @@
+// Host replayer for the pot's decision trace (dumped with 't' on the serial monitor,
+// or the smartpot/trace chunks appended to one file).
+// Feeds the recorded sensor, connectivity, power and wake inputs through the pot's own
+// decisions.h and drying-model.h, prints the resulting WATER/BEEP/SLEEP decisions and
+// compares them with the ones the device recorded.
+//
+//   g++ -std=c++11 -O2 -I smart-pot-code tools/trace-replay.cpp -o trace-replay
+//   ./trace-replay trace.csv > decisions.csv     # decisions on stdout, comparison on stderr
+//   ./trace-replay --bench trace.csv             # replay speed, fails below REPLAY_SPEED_FLOOR
+//
+// Build it once per checkout (-I <checkout>/smart-pot-code) and diff the two decisions.csv
+// to see what a change to the decision logic does to a real trace.
+// Host longs are 64 bit, so a trace crossing the pot's 49-day clock wrap replays differently.
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------
+// ------------------------- HOST STAND-INS ---------------------------------
+// --------------------------------------------------------------------------
+// Just enough of the Arduino core for the pot's headers to compile unchanged.
+
+#define RTC_DATA_ATTR
+typedef std::string String;
+struct IPAddress {
+  IPAddress(int, int, int, int) {}
+};
+enum { LOW = 0, INPUT = 1, INPUT_PULLUP = 2 };
+static unsigned long hostMillis = 0;
+inline unsigned long millis() { return hostMillis; }
+inline void pinMode(int, int) {}
+inline int digitalRead(int) { return 1; }
+inline uint32_t analogReadMilliVolts(int) { return 0; }
+struct Print {
+  void print(const char* text) { fputs(text, stdout); }
+  void println(const char* text) { puts(text); }
+  void println(unsigned long value) { printf("%lu\n", value); }
+  template<typename... Args>
+  void printf(const char* format, Args... args) { ::printf(format, args...); }
+};
+
+#include "config.h"
+#include "drying-model.h"
+#include "decisions.h"
+#include "trace.h"
+#include "power-monitor.h"
+
+// --------------------------------------------------------------------------
+// ------------------------- REPLAY -----------------------------------------
+// --------------------------------------------------------------------------
+
+const unsigned long LOOP_PERIOD = 100;          // ms, delay(100) in loop()
+const unsigned long AWAKE_TAIL = 60000;         // ms replayed past a wake's last input when it has no SLEEP
+const unsigned long MATCH_TOLERANCE = 3000;     // ms, loop work and blocking delays the replay doesn't model
+const double REPLAY_SPEED_FLOOR = 1000;         // x real time, --bench fails below this
+
+struct TraceLine {
+  uint32_t time;
+  uint8_t event;
+  int a;
+  int b;
+};
+
+struct Decision {
+  uint32_t time;
+  uint8_t event;
+  long value;  // WATER/BEEP: moisture (0.1 %), SLEEP: seconds
+};
+
+static const float DEFAULT_MOISTURE_THRESHOLD = MOISTURE_THRESHOLD_PERCENT;
+static const float DEFAULT_SUNLIGHT_THRESHOLD = SUNLIGHT_THRESHOLD_LUX;
+
+static inline bool isDecision(uint8_t event) {
+  return event == TRACE_WATER || event == TRACE_BEEP || event == TRACE_SLEEP;
+}
+
+static bool loadTrace(const char* path, std::vector<TraceLine>& trace, unsigned long& dropped) {
+  FILE* file = fopen(path, "r");
+  if (!file) return false;
+
+  char line[128];
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') {
+      unsigned long lost = 0;
+      if (sscanf(line, "# dropped %lu", &lost) == 1) dropped += lost;  // Once per dump, or per overflowed MQTT chunk
+      continue;
+    }
+
+    unsigned long time;
+    char name[24];
+    int a = 0;
+    int b = 0;
+    if (sscanf(line, "%lu,%23[^,],%d,%d", &time, name, &a, &b) < 2) continue;
+    for (uint8_t event = 0; event < TRACE_EVENT_COUNT; event++) {
+      if (strcmp(name, TraceRecorder::eventName(event)) == 0) {
+        trace.push_back({ (uint32_t)time, event, a, b });
+        break;
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// The sketch's globals that feed the decisions, reset on every wake like RAM
+struct WakeInputs {
+  int moistureLevel = 0;
+  float temperature = 0.0;
+  bool dark = false;
+  bool mqttConnected = false;
+  bool dataSent = false;
+};
+
+// Logged by setup() before the first loop()
+static inline bool isSetupEvent(uint8_t event) {
+  return event == TRACE_POWER || event == TRACE_CONFIG || event == TRACE_MOISTURE;
+}
+
+class Replayer {
+private:
+  DryingModel dryingModel;
+  unsigned long coveredMs;  // Device time the replay stood in for, awake and asleep
+
+  void apply(const TraceLine& line, WakeInputs& inputs) {
+    switch (line.event) {
+      case TRACE_SENSORS:
+        inputs.moistureLevel = line.a;
+        inputs.dark = DecisionLogic::isDark(line.b);
+        inputs.dataSent = true;
+        break;
+      case TRACE_TEMPERATURE:
+        // Logged right after SENSORS, the drying model is fed with both
+        inputs.temperature = line.a / 100.0;
+        dryingModel.addSample(line.time, inputs.moistureLevel, inputs.temperature,
+                              rtcData.lastWateringTime > dryingState.lastSampleTime);
+        break;
+      case TRACE_MOISTURE:
+        inputs.moistureLevel = line.a;
+        break;
+      case TRACE_LIGHT:
+        inputs.dark = DecisionLogic::isDark(line.a);
+        break;
+      case TRACE_MQTT_UP:
+        inputs.mqttConnected = true;
+        break;
+      case TRACE_MQTT_DOWN:
+      case TRACE_WIFI_DOWN:
+        inputs.mqttConnected = false;
+        break;
+      case TRACE_POWER:
+        powerState.batteryTier = (PowerTier)line.b;
+        break;
+      case TRACE_CONFIG:
+        MOISTURE_THRESHOLD_PERCENT = line.a / 100.0;
+        SUNLIGHT_THRESHOLD_LUX = line.b / 10.0;
+        break;
+    }
+  }
+
+  // One wake, from its WAKE line up to the next one: RAM state starts over, RTC state carries on
+  void replayWake(const std::vector<TraceLine>& trace, size_t begin, size_t end, std::vector<Decision>& decisions) {
+    DecisionLogic logic;
+    PowerMonitor powerMonitor;
+    WakeInputs inputs;
+
+    uint32_t wake = trace[begin].time;
+    uint32_t lastInput = trace[end - 1].time;
+    size_t next = begin + 1;
+    while (next < end && isSetupEvent(trace[next].event)) apply(trace[next++], inputs);
+
+    for (unsigned long currentMillis = trace[next - 1].time - wake;; currentMillis += LOOP_PERIOD) {
+      uint32_t now = wake + currentMillis;
+      hostMillis = currentMillis;
+
+      // Inputs recorded up to this loop iteration
+      for (; next < end && trace[next].time <= now; next++) apply(trace[next], inputs);
+
+      // Same order as loop(): buzzer, automation while on the broker, sleep check
+      if (logic.shouldBeep(now, inputs.moistureLevel, powerMonitor.allowsBuzzer())) {
+        decisions.push_back({ now, TRACE_BEEP, inputs.moistureLevel });
+      }
+      if (inputs.mqttConnected && logic.isWateringCheckDue(currentMillis) && logic.shouldWater(now, inputs.moistureLevel)) {
+        decisions.push_back({ now, TRACE_WATER, inputs.moistureLevel });
+      }
+      if (logic.canSleep(currentMillis, 0, inputs.dark, powerMonitor.staysAwakeInDaylight(), inputs.dataSent, inputs.mqttConnected)) {
+        unsigned long sleepMs = logic.sleepTime(dryingModel, inputs.moistureLevel, inputs.temperature, powerMonitor.getStretch());
+        decisions.push_back({ now, TRACE_SLEEP, (long)(sleepMs / 1000) });
+        coveredMs += currentMillis + sleepMs;
+        return;
+      }
+
+      // Trace ends (or the device reset) while awake
+      if (next == end && now - lastInput >= AWAKE_TAIL) {
+        coveredMs += currentMillis;
+        return;
+      }
+    }
+  }
+
+public:
+  Replayer()
+    : coveredMs(0) {}
+
+  inline unsigned long getCoveredMs() const {
+    return coveredMs;
+  }
+
+  // Replays every complete wake; lines before the first WAKE belong to a wake cut off by the ring
+  void replay(const std::vector<TraceLine>& trace, std::vector<Decision>& decisions) {
+    rtcData = decltype(rtcData)();
+    dryingState = decltype(dryingState)();
+    powerState = decltype(powerState)();
+    MOISTURE_THRESHOLD_PERCENT = DEFAULT_MOISTURE_THRESHOLD;
+    SUNLIGHT_THRESHOLD_LUX = DEFAULT_SUNLIGHT_THRESHOLD;
+    coveredMs = 0;
+
+    size_t begin = 0;
+    while (begin < trace.size() && trace[begin].event != TRACE_WAKE) begin++;
+    while (begin < trace.size()) {
+      size_t end = begin + 1;
+      while (end < trace.size() && trace[end].event != TRACE_WAKE) end++;
+      replayWake(trace, begin, end, decisions);
+      begin = end;
+    }
+  }
+};
+
+// --------------------------------------------------------------------------
+// ------------------------- COMPARISON -------------------------------------
+// --------------------------------------------------------------------------
+
+static bool sameDecision(const Decision& recorded, const Decision& replayed) {
+  if (recorded.event != replayed.event) return false;
+  long difference = (long)(replayed.time - recorded.time);
+  if (labs(difference) > (long)MATCH_TOLERANCE) return false;
+
+  // Sleep length comes from float math on temperatures logged at 0.01 C, allow 1 %
+  if (recorded.event == TRACE_SLEEP) return labs(recorded.value - replayed.value) <= 1 + recorded.value / 100;
+  return true;
+}
+
+// Prints decisions present on only one side, returns how many
+static int compare(const std::vector<Decision>& recorded, const std::vector<Decision>& replayed) {
+  std::vector<bool> matched(replayed.size(), false);
+  int mismatches = 0;
+
+  for (const Decision& decision : recorded) {
+    bool found = false;
+    for (size_t i = 0; i < replayed.size() && !found; i++) {
+      if (!matched[i] && sameDecision(decision, replayed[i])) matched[i] = found = true;
+    }
+    if (!found) {
+      fprintf(stderr, "  device only: %lu,%s,%ld\n", (unsigned long)decision.time, TraceRecorder::eventName(decision.event), decision.value);
+      mismatches++;
+    }
+  }
+  for (size_t i = 0; i < replayed.size(); i++) {
+    if (matched[i]) continue;
+    fprintf(stderr, "  replay only: %lu,%s,%ld\n", (unsigned long)replayed[i].time, TraceRecorder::eventName(replayed[i].event), replayed[i].value);
+    mismatches++;
+  }
+  return mismatches;
+}
+
+int main(int argc, char** argv) {
+  bool bench = argc == 3 && strcmp(argv[1], "--bench") == 0;
+  if (argc != 2 && !bench) {
+    fprintf(stderr, "usage: %s [--bench] <trace.csv>\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<TraceLine> trace;
+  unsigned long dropped = 0;
+  if (!loadTrace(argv[argc - 1], trace, dropped)) {
+    fprintf(stderr, "cannot read %s\n", argv[argc - 1]);
+    return 2;
+  }
+
+  std::vector<Decision> recorded;
+  for (const TraceLine& line : trace) {
+    if (isDecision(line.event)) recorded.push_back({ line.time, line.event, line.a });
+  }
+
+  Replayer replayer;
+  std::vector<Decision> replayed;
+  replayer.replay(trace, replayed);
+
+  if (bench) {
+    // Repeat until the timing is meaningful
+    int runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsedMs = 0;
+    while (elapsedMs < 500) {
+      std::vector<Decision> scratch;
+      replayer.replay(trace, scratch);
+      runs++;
+      elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    double perRunMs = elapsedMs / runs;
+    double speed = replayer.getCoveredMs() / perRunMs;
+    printf("%zu trace lines, %.1f h of device time, %.3f ms per replay, %.0fx real time (floor %.0fx)\n",
+           trace.size(), replayer.getCoveredMs() / 3600000.0, perRunMs, speed, REPLAY_SPEED_FLOOR);
+    return speed >= REPLAY_SPEED_FLOOR ? 0 : 1;
+  }
+
+  printf("# smart-pot decisions v1\n# time_ms,event,value\n");
+  for (const Decision& decision : replayed) {
+    printf("%lu,%s,%ld\n", (unsigned long)decision.time, TraceRecorder::eventName(decision.event), decision.value);
+  }
+
+  if (dropped) fprintf(stderr, "trace lost %lu lines, decisions right after a gap may differ\n", dropped);
+  int mismatches = compare(recorded, replayed);
+  fprintf(stderr, "%zu device decisions, %zu replayed, %d mismatch(es)\n", recorded.size(), replayed.size(), mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -7,19 +7,50 @@
 // Pins
 constexpr uint8_t PUMP_PIN = 0;
 constexpr uint8_t BTN_PIN = 1;
+constexpr int8_t WATER_LEVEL_PIN = -1;  // Analog level sensor at the bottom of the reservoir, -1 = not fitted (v4), GPIO3/4 if added
 
 // MQTT & WiFi
 const char* MQTT_TOPIC_WATER_COMMAND = "smartpot/water_command";
+const char* MQTT_TOPIC_STATION_DIAGNOSTICS = "smartpot/station_diagnostics";
+const char* MQTT_TOPIC_STATION_LATENCY = "smartpot/station_latency";
+const char* MQTT_TOPIC_RESERVOIR_LITRES = "smartpot/reservoir_litres";
+const char* MQTT_TOPIC_RESERVOIR_DAYS_LEFT = "smartpot/reservoir_days_left";
+const char* MQTT_TOPIC_RESERVOIR_LOW = "smartpot/reservoir_low";
+const char* MQTT_TOPIC_RESERVOIR_REFILL = "smartpot/reservoir_refill";  // Payload: litres in the tank, "full" = capacity
+const char* MQTT_TOPIC_OTA = "smartpot/ota/station";  // Payload: URL of a delta or full image
+const char* MQTT_TOPIC_OTA_STATUS = "smartpot/ota_status";
 constexpr int MQTT_RECONNECT_ATTEMPTS = 5;
+constexpr bool MQTT_PERSISTENT_SESSION = true;  // Stable client ID + cleanSession=false, commands queued during outages
+constexpr uint16_t MQTT_KEEPALIVE = 30;         // Seconds
 
 // Timing variables
 const unsigned long AP_TIMEOUT = 120000UL;          // 2 minutes
 const unsigned long WIFI_RETRY_INTERVAL = 15000UL;  // 15 seconds
 const unsigned long STATUS_LOG_INTERVAL = 10000UL;  // 10 seconds
+const unsigned long DIAGNOSTICS_INTERVAL = 60000UL; // 1 minute
+const unsigned long LATENCY_REPORT_INTERVAL = 60000UL; // 1 minute
+const unsigned long WATER_LEVEL_SAMPLE_INTERVAL = 5000UL;  // 5 seconds while idle
+const unsigned long RESERVOIR_PUBLISH_INTERVAL = 600000UL; // 10 minutes
+
+// OTA updates (see ota-updater.h)
+const unsigned long OTA_READ_TIMEOUT = 10000UL;     // Abort a download stalled for 10 seconds
+const unsigned long OTA_VERIFY_TIMEOUT = 300000UL;  // New image must reach the broker within 5 minutes or roll back
+const char* OTA_KEY = "";  // Shared secret that signs updates (tools/ota-delta.py), set your own; empty = updates refused
 
 // Watering
 const unsigned long WATERING_DURATION = 5000UL;  // 5 seconds
 const char* WATERING_CODE = "1";
+const unsigned long MIN_PUMP_RUN_TIME = 1000UL;  // Shorter runs aren't worth starting
+
+// Reservoir
+constexpr float RESERVOIR_CAPACITY_LITRES = 5.0;
+constexpr float RESERVOIR_LOW_LITRES = 1.0;      // Reported as low below this
+constexpr float RESERVOIR_RESERVE_LITRES = 0.2;  // Never pumped, keeps the intake submerged
+constexpr float RESERVOIR_COVERED_LITRES = 0.5;  // At least this much left while the sensor reads covered
+constexpr float PUMP_FLOW_LPM = 1.2;             // Litres per minute, measure for your pump
+constexpr int WATER_LEVEL_EMPTY_THRESHOLD = 500;    // Raw ADC, sensor dry = pump stops
+constexpr int WATER_LEVEL_LOW_THRESHOLD = 1000;     // Raw ADC, arms refill detection
+constexpr int WATER_LEVEL_REFILL_THRESHOLD = 2500;  // Raw ADC, sensor covered again = tank full
 
 // Access point
 const IPAddress localIP(192, 168, 4, 1);
@@ -51,7 +82,19 @@ enum WiFiState {
 // AP & Wifi variables
 WiFiState currentWiFiState = WIFI_SETUP_MODE;
 unsigned long lastWiFiAttempt = 0;
+bool wifiLinkLost = false;  // A connect failed or the link dropped, the next connect counts as a reconnect
+bool mqttConnectedOnce = false;  // The first broker connect after boot isn't a reconnect
 
 // Pump control
 bool pumpActive = false;
-unsigned long pumpStartTime = 0;
\ No newline at end of file
+unsigned long pumpStartTime = 0;
+unsigned long pumpRunDuration = 0;  // Budgeted by the reservoir, <= WATERING_DURATION
+
+// Reservoir changed since the last publish, published from loop() (never from the MQTT callback)
+bool reservoirDirty = false;
+
+// Firmware update requested over MQTT or the portal
+String pendingUpdateUrl = "";
+
+// Button falling edge timestamp (micros), set from ISR
+volatile uint32_t buttonEdgeMicros = 0;
\ No newline at end of file
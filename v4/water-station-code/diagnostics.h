@@ -0,0 +1,94 @@
+#pragma once
+#include <esp_heap_caps.h>
+
+class Diagnostics {
+private:
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;
+  uint32_t largestFreeBlock;
+  uint32_t stackHighWaterMark;
+  uint32_t wifiReconnects;
+  uint32_t mqttReconnects;
+  uint32_t publishFailures;
+  uint32_t pumpRuns;
+
+public:
+  Diagnostics()
+    : freeHeap(0),
+      minFreeHeap(0),
+      largestFreeBlock(0),
+      stackHighWaterMark(0),
+      wifiReconnects(0),
+      mqttReconnects(0),
+      publishFailures(0),
+      pumpRuns(0) {}
+
+  // --------------------------------------------------------------------------
+  // ------------------------- SAMPLING ---------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Cheap heap/stack snapshot, call from the loop task
+  void sample() {
+    freeHeap = ESP.getFreeHeap();
+    minFreeHeap = ESP.getMinFreeHeap();
+    largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stackHighWaterMark = uxTaskGetStackHighWaterMark(NULL);
+  }
+
+  inline uint32_t getFreeHeap() const {
+    return freeHeap;
+  }
+  inline uint32_t getLargestFreeBlock() const {
+    return largestFreeBlock;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- COUNTERS ---------------------------------------
+  // --------------------------------------------------------------------------
+  inline void countWiFiReconnect() {
+    wifiReconnects++;
+  }
+  inline void countMQTTReconnect() {
+    mqttReconnects++;
+  }
+  inline void countPublishFailure() {
+    publishFailures++;
+  }
+  inline void countPumpRun() {
+    pumpRuns++;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- FORMATTING -------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Compact JSON for the retained MQTT topic (fits PubSubClient's 256 byte buffer)
+  int toJson(char* buffer, size_t size) const {
+    return snprintf(buffer, size,
+                    "{\"heap\":%lu,\"minHeap\":%lu,\"maxBlock\":%lu,\"stack\":%lu,"
+                    "\"wifiRc\":%lu,\"mqttRc\":%lu,\"pubFail\":%lu,\"pumpRuns\":%lu}",
+                    (unsigned long)freeHeap, (unsigned long)minFreeHeap,
+                    (unsigned long)largestFreeBlock, (unsigned long)stackHighWaterMark,
+                    (unsigned long)wifiReconnects, (unsigned long)mqttReconnects,
+                    (unsigned long)publishFailures, (unsigned long)pumpRuns);
+  }
+
+  // Plain "name value" lines for the /metrics endpoint
+  int toMetrics(char* buffer, size_t size) const {
+    return snprintf(buffer, size,
+                    "free_heap_bytes %lu\n"
+                    "min_free_heap_bytes %lu\n"
+                    "largest_free_block_bytes %lu\n"
+                    "loop_stack_high_water_bytes %lu\n"
+                    "wifi_reconnects_total %lu\n"
+                    "mqtt_reconnects_total %lu\n"
+                    "publish_failures_total %lu\n"
+                    "pump_runs_total %lu\n"
+                    "uptime_ms %lu\n",
+                    (unsigned long)freeHeap, (unsigned long)minFreeHeap,
+                    (unsigned long)largestFreeBlock, (unsigned long)stackHighWaterMark,
+                    (unsigned long)wifiReconnects, (unsigned long)mqttReconnects,
+                    (unsigned long)publishFailures, (unsigned long)pumpRuns,
+                    millis());
+  }
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+// Log2-bucketed latency histogram in microseconds.
+// Bucket i holds samples in [2^i, 2^(i+1)) us, bucket 0 also holds 0 us.
+// The last bucket collects everything above ~8 s (blocking reconnects).
+class LatencyHistogram {
+private:
+  static constexpr uint8_t BUCKET_COUNT = 24;
+  uint32_t buckets[BUCKET_COUNT];
+  uint32_t count;
+  uint32_t maxMicros;
+
+  static inline uint8_t bucketFor(uint32_t micros) {
+    if (micros < 2) return 0;
+    uint8_t index = 31 - __builtin_clz(micros);
+    return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+  }
+
+public:
+  LatencyHistogram() {
+    reset();
+  }
+
+  void reset() {
+    for (uint8_t i = 0; i < BUCKET_COUNT; i++) buckets[i] = 0;
+    count = 0;
+    maxMicros = 0;
+  }
+
+  // O(1), safe to call every loop iteration
+  inline void record(uint32_t micros) {
+    buckets[bucketFor(micros)]++;
+    count++;
+    if (micros > maxMicros) maxMicros = micros;
+  }
+
+  inline uint32_t getCount() const {
+    return count;
+  }
+  inline uint32_t getMax() const {
+    return maxMicros;
+  }
+
+  // Upper bound (us) of the bucket containing the given percentile (0-100)
+  uint32_t percentile(uint8_t pct) const {
+    if (count == 0) return 0;
+    uint32_t target = ((uint64_t)count * pct + 99) / 100;
+    if (target == 0) target = 1;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+      seen += buckets[i];
+      if (seen >= target) {
+        uint32_t upper = 2UL << i;
+        return upper < maxMicros ? upper : maxMicros;
+      }
+    }
+    return maxMicros;
+  }
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <Preferences.h>
+
+// Reservoir tracking: litres estimated from pump run time, corrected by the level sensor.
+// The sensor only covers the bottom of the tank, so it acts as the empty/refill reference.
+// Without a sensor (WATER_LEVEL_PIN < 0) the estimate and manual refills are all there is.
+class Reservoir {
+private:
+  float litres;            // Estimated water left
+  float dailyUsage;        // Smoothed litres per day, 0 until known
+  float usageToday;        // Litres used since dayStart
+  unsigned long dayStart;  // millis() at the start of the usage window
+  int level;               // Smoothed raw sensor reading, -1 = no sensor or not sampled yet
+  bool lowSeen;            // Sensor went low since the last refill
+
+  void save() {
+    Preferences reservoirPrefs;
+    reservoirPrefs.begin("reservoir", false);
+    reservoirPrefs.putFloat("litres", litres);
+    reservoirPrefs.putFloat("daily", dailyUsage);
+    reservoirPrefs.end();
+  }
+
+public:
+  Reservoir()
+    : litres(RESERVOIR_CAPACITY_LITRES),
+      dailyUsage(0),
+      usageToday(0),
+      dayStart(0),
+      level(-1),
+      lowSeen(false) {}
+
+  void begin() {
+    Preferences reservoirPrefs;
+    reservoirPrefs.begin("reservoir", true);
+    litres = reservoirPrefs.getFloat("litres", RESERVOIR_CAPACITY_LITRES);
+    dailyUsage = reservoirPrefs.getFloat("daily", 0);
+    reservoirPrefs.end();
+
+    if (WATER_LEVEL_PIN >= 0) pinMode(WATER_LEVEL_PIN, INPUT);
+    dayStart = millis();
+    sample();
+
+    Serial.println("Reservoir: " + String(litres, 2) + " L");
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- SENSOR -----------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Cheap enough to call every loop while the pump runs
+  void sample() {
+    if (WATER_LEVEL_PIN < 0) return;
+
+    int raw = analogRead(WATER_LEVEL_PIN);
+    level = level < 0 ? raw : (level * 3 + raw) / 4;
+
+    if (level < WATER_LEVEL_LOW_THRESHOLD) lowSeen = true;
+
+    // Sensor covered again after being low: tank was refilled
+    if (lowSeen && level >= WATER_LEVEL_REFILL_THRESHOLD) {
+      lowSeen = false;
+      litres = RESERVOIR_CAPACITY_LITRES;
+      save();
+      Serial.println("Reservoir: refill detected");
+    }
+
+    // Sensor is the ground truth near the bottom, both ways: a covered sensor
+    // means the tank was topped up before it ever read low
+    if (isEmpty() && litres > RESERVOIR_RESERVE_LITRES) {
+      litres = RESERVOIR_RESERVE_LITRES;
+    } else if (level >= WATER_LEVEL_REFILL_THRESHOLD && litres < RESERVOIR_COVERED_LITRES) {
+      litres = RESERVOIR_COVERED_LITRES;
+      save();
+    }
+  }
+
+  // Manual refill from MQTT or the portal, <= 0 = filled to capacity
+  void refill(float amount) {
+    litres = amount > 0 && amount < RESERVOIR_CAPACITY_LITRES ? amount : RESERVOIR_CAPACITY_LITRES;
+    lowSeen = false;
+    save();
+    Serial.println("Reservoir: refilled to " + String(litres, 2) + " L");
+  }
+
+  inline bool isEmpty() const {
+    return WATER_LEVEL_PIN >= 0 && level < WATER_LEVEL_EMPTY_THRESHOLD;
+  }
+  inline bool isLow() const {
+    return isEmpty() || litres <= RESERVOIR_LOW_LITRES;
+  }
+  inline int getLevel() const {
+    return level;
+  }
+  inline float getLitres() const {
+    return litres;
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- PUMP BUDGET ------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Run time (ms) the tank can supply, shortened near empty, 0 = don't run
+  unsigned long allowedRunTime(unsigned long requestedMs) const {
+    if (isEmpty()) return 0;
+
+    float usable = litres - RESERVOIR_RESERVE_LITRES;
+    if (usable <= 0) return 0;
+
+    unsigned long availableMs = usable / PUMP_FLOW_LPM * 60000.0;
+    if (availableMs < MIN_PUMP_RUN_TIME) return 0;
+    return availableMs < requestedMs ? availableMs : requestedMs;
+  }
+
+  void consume(unsigned long runMs) {
+    float used = PUMP_FLOW_LPM * runMs / 60000.0;
+    litres = litres > used ? litres - used : 0;
+    usageToday += used;
+    save();
+  }
+
+  // --------------------------------------------------------------------------
+  // ------------------------- PROJECTION -------------------------------------
+  // --------------------------------------------------------------------------
+
+  // Roll the daily usage window, call periodically
+  void update(unsigned long currentMillis) {
+    if (currentMillis - dayStart < 86400000UL) return;
+    dailyUsage = dailyUsage > 0 ? dailyUsage * 0.7 + usageToday * 0.3 : usageToday;
+    usageToday = 0;
+    dayStart = currentMillis;
+    save();
+  }
+
+  // Projected days until empty at the current usage rate, -1 if unknown
+  float daysToEmpty(unsigned long currentMillis) const {
+    float rate = dailyUsage;
+
+    // No full day yet, extrapolate from today after at least an hour
+    if (rate <= 0) {
+      float elapsedDays = (currentMillis - dayStart) / 86400000.0;
+      if (elapsedDays < 1.0 / 24 || usageToday <= 0) return -1;
+      rate = usageToday / elapsedDays;
+    }
+
+    float usable = litres - RESERVOIR_RESERVE_LITRES;
+    return usable > 0 ? usable / rate : 0;
+  }
+};
@@ -5,6 +5,10 @@
 #include <DNSServer.h>
 #include <WebServer.h>
 #include "html.h"
+#include "diagnostics.h"
+#include "latency-histogram.h"
+#include "reservoir.h"
+#include "ota-updater.h"
 
 // --------------------------------------------------------------------------
 // ------------------------- GLOBAL INSTANCES -------------------------------
@@ -15,6 +19,12 @@ PubSubClient client(espClient);
 Preferences preferences;
 DNSServer dnsServer;
 WebServer server(80);
+Diagnostics diagnostics;
+LatencyHistogram loopLatency;
+LatencyHistogram buttonLatency;
+LatencyHistogram mqttLatency;
+Reservoir reservoir;
+OtaUpdater ota;
 
 // --------------------------------------------------------------------------
 // ------------------------- GLOBAL VARIABLES -------------------------------
@@ -26,12 +36,24 @@ bool credentialsSaved = false;
 String savedSSID = "";
 String savedPassword = "";
 
+// Keep a freshly updated image unconfirmed until it reaches the broker (see ota-updater.h)
+extern "C" bool verifyRollbackLater() {
+  return true;
+}
+
 // --------------------------------------------------------------------------
 // ------------------------- FUNCTION PROTOTYPES ----------------------------
 // --------------------------------------------------------------------------
 
 void mqttCallback(char* topic, uint8_t* payload, unsigned int length);
 void reconnectMQTT();
+void publishDiagnostics();
+void reportLatency();
+void publishReservoir();
+bool startPump(uint32_t triggerMicros, LatencyHistogram& latency);
+void stopPump();
+void runPendingUpdate();
+void IRAM_ATTR onButtonFalling();
 bool loadMQTTConfig();
 bool loadWiFiCredentials();
 void saveConfiguration(String ssid, String wifiPass, String mqttServer, int mqttPort, String mqttUser, String mqttPass);
@@ -56,6 +78,15 @@ void setup() {
   // Default pin states
   digitalWrite(PUMP_PIN, LOW);
 
+  // Restore reservoir estimate
+  reservoir.begin();
+
+  // Check whether this is the first boot of a new image
+  ota.begin();
+
+  // Timestamp button presses for latency measurement
+  attachInterrupt(digitalPinToInterrupt(BTN_PIN), onButtonFalling, FALLING);
+
   // Add MQTT callback
   client.setCallback(mqttCallback);
 
@@ -72,6 +103,7 @@ void setup() {
 
 void loop() {
   unsigned long currentMillis = millis();
+  uint32_t loopStartMicros = micros();
 
   // Handle AP mode
   if (apModeActive) {
@@ -108,7 +140,13 @@ void loop() {
   switch (currentWiFiState) {
     case WIFI_CONNECTING:
       currentWiFiState = connectWiFi() ? WIFI_CONNECTED : WIFI_FAILED;
-      if (currentWiFiState == WIFI_FAILED) lastWiFiAttempt = currentMillis;
+      if (currentWiFiState == WIFI_FAILED) {
+        lastWiFiAttempt = currentMillis;
+        wifiLinkLost = true;
+      } else if (wifiLinkLost) {
+        diagnostics.countWiFiReconnect();
+        wifiLinkLost = false;
+      }
       break;
 
     case WIFI_CONNECTED:
@@ -116,6 +154,7 @@ void loop() {
         Serial.println("WiFi connection lost");
         currentWiFiState = WIFI_FAILED;
         lastWiFiAttempt = currentMillis;
+        wifiLinkLost = true;
         break;
       }
 
@@ -152,28 +191,76 @@ void loop() {
   // Manual pump button (active LOW)
   if (digitalRead(BTN_PIN) == LOW && !pumpActive) {
     Serial.println("Manual pump activation");
-    digitalWrite(PUMP_PIN, HIGH);
-    pumpActive = true;
-    pumpStartTime = currentMillis;
+    uint32_t edgeMicros = buttonEdgeMicros;
+    startPump(edgeMicros ? edgeMicros : micros(), buttonLatency);
   }
 
-  // Auto-stop pump after duration
-  if (pumpActive && (currentMillis - pumpStartTime >= WATERING_DURATION)) {
-    digitalWrite(PUMP_PIN, LOW);
-    pumpActive = false;
-    Serial.println("Pump deactivated");
+  // Discard edges from presses during a run or released before being polled
+  if (pumpActive || digitalRead(BTN_PIN) == HIGH) buttonEdgeMicros = 0;
+
+  // Water level: every loop while pumping, slower when idle
+  static unsigned long lastLevelSample = 0;
+  if (pumpActive || currentMillis - lastLevelSample >= WATER_LEVEL_SAMPLE_INTERVAL) {
+    lastLevelSample = currentMillis;
+    reservoir.sample();
+    reservoir.update(currentMillis);
   }
 
+  // Auto-stop pump after its budgeted run, or immediately if the tank runs dry
+  if (pumpActive) {
+    if (reservoir.isEmpty()) {
+      Serial.println("Reservoir empty - stopping pump");
+      stopPump();
+    } else if (currentMillis - pumpStartTime >= pumpRunDuration) {
+      stopPump();
+    }
+  }
+
+  // Firmware update, never while watering
+  if (!pendingUpdateUrl.isEmpty() && !pumpActive) runPendingUpdate();
+
+  // New image never reached the broker, go back to the previous one
+  if (ota.isPendingVerify() && currentMillis >= OTA_VERIFY_TIMEOUT) ota.rollback();
+
   // Status logging
   static unsigned long lastStatusPrint = 0;
   if (currentMillis - lastStatusPrint >= STATUS_LOG_INTERVAL) {
     lastStatusPrint = currentMillis;
+    diagnostics.sample();
 
     const char* wifiStatus[] = { "SETUP", "CONNECTING", "CONNECTED", "FAILED" };
     Serial.println("WiFi: " + String(wifiStatus[currentWiFiState]));
     Serial.println("MQTT: " + String(client.connected() ? "CONNECTED" : "DISCONNECTED"));
+    Serial.println("Heap: " + String(diagnostics.getFreeHeap()) + " free, " + String(diagnostics.getLargestFreeBlock()) + " largest block");
+  }
+
+  // Diagnostics publishing (sampled with the status log)
+  static unsigned long lastDiagnostics = 0;
+  if (currentMillis - lastDiagnostics >= DIAGNOSTICS_INTERVAL) {
+    lastDiagnostics = currentMillis;
+    if (client.connected()) publishDiagnostics();
   }
 
+  // Reservoir level and projection, periodically and after every change
+  static unsigned long lastReservoirPublish = 0;
+  if (reservoirDirty || currentMillis - lastReservoirPublish >= RESERVOIR_PUBLISH_INTERVAL) {
+    lastReservoirPublish = currentMillis;
+    if (client.connected()) {
+      publishReservoir();
+      reservoirDirty = false;
+    }
+  }
+
+  // Latency percentiles
+  static unsigned long lastLatencyReport = 0;
+  if (currentMillis - lastLatencyReport >= LATENCY_REPORT_INTERVAL) {
+    lastLatencyReport = currentMillis;
+    reportLatency();
+  }
+
+  // Loop work time, excluding the idle delay below
+  loopLatency.record(micros() - loopStartMicros);
+
   delay(100);
 }
 
@@ -182,6 +269,11 @@ void loop() {
 // --------------------------------------------------------------------------
 
 void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+  uint32_t receivedMicros = micros();
+
+  // Copy the topic first, it points into the client buffer that any publish overwrites
+  String topicName(topic);
+
   // Copy payload to message
   String message = "";
   for (unsigned int i = 0; i < length; i++) {
@@ -189,14 +281,23 @@ void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
   }
 
   // Output message
-  Serial.println("MQTT: " + String(topic) + " = " + message);
+  Serial.println("MQTT: " + topicName + " = " + message);
 
   // If watering code received => turn pump on
-  if (String(topic) == MQTT_TOPIC_WATER_COMMAND && message == "1" && !pumpActive) {
+  if (topicName == MQTT_TOPIC_WATER_COMMAND && message == "1" && !pumpActive) {
     Serial.println("MQTT watering command received");
-    digitalWrite(PUMP_PIN, HIGH);
-    pumpActive = true;
-    pumpStartTime = millis();
+    startPump(receivedMicros, mqttLatency);
+  }
+
+  // Tank topped up by hand
+  if (topicName == MQTT_TOPIC_RESERVOIR_REFILL) {
+    reservoir.refill(message.toFloat());
+    reservoirDirty = true;
+  }
+
+  // Firmware update, applied from loop()
+  if (topicName == MQTT_TOPIC_OTA && !message.isEmpty()) {
+    pendingUpdateUrl = message;
   }
 }
 
@@ -205,10 +306,25 @@ void reconnectMQTT() {
 
   // Attempt MQTT connection
   for (int attempts = 0; attempts < MQTT_RECONNECT_ATTEMPTS && !client.connected(); attempts++) {
-    String clientId = "water_station_" + String(random(0xffff), HEX);
-    if (client.connect(clientId.c_str(), MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str())) {
-      if (client.subscribe(MQTT_TOPIC_WATER_COMMAND)) {
-        Serial.println("MQTT subscribed to: " + String(MQTT_TOPIC_WATER_COMMAND));
+    bool connected;
+    if (MQTT_PERSISTENT_SESSION) {
+      // Stable ID per device, cleanSession=false keeps subscriptions and queued QoS 1 commands
+      char clientId[24];
+      snprintf(clientId, sizeof(clientId), "water_station_%06lx", (unsigned long)((ESP.getEfuseMac() >> 24) & 0xFFFFFF));
+      connected = client.connect(clientId, MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str(), nullptr, 0, false, nullptr, false);
+    } else {
+      String clientId = "water_station_" + String(random(0xffff), HEX);
+      connected = client.connect(clientId.c_str(), MQTT_USERNAME.c_str(), MQTT_PASSWORD.c_str());
+    }
+
+    if (connected) {
+      if (mqttConnectedOnce) diagnostics.countMQTTReconnect();
+      mqttConnectedOnce = true;
+      ota.confirm();  // Reaching the broker proves a freshly updated image works
+
+      // Always subscribe, a broker restarted without persistence has dropped the session
+      if (client.subscribe(MQTT_TOPIC_WATER_COMMAND, 1) && client.subscribe(MQTT_TOPIC_RESERVOIR_REFILL, 1) && client.subscribe(MQTT_TOPIC_OTA, 1)) {
+        Serial.println("MQTT subscribed to: " + String(MQTT_TOPIC_WATER_COMMAND) + ", " + String(MQTT_TOPIC_RESERVOIR_REFILL) + ", " + String(MQTT_TOPIC_OTA));
       }
       return;
     }
@@ -219,6 +335,54 @@ void reconnectMQTT() {
   }
 }
 
+// Publish retained heap/stack snapshot with event counters
+void publishDiagnostics() {
+  char diagBuffer[200];
+  diagnostics.toJson(diagBuffer, sizeof(diagBuffer));
+  if (!client.publish(MQTT_TOPIC_STATION_DIAGNOSTICS, diagBuffer, true)) {
+    diagnostics.countPublishFailure();
+  }
+}
+
+// Print and publish p50/p90/p99/max for each histogram, then start a new window
+void reportLatency() {
+  struct {
+    const char* name;
+    LatencyHistogram* histogram;
+  } reports[] = {
+    { "loop", &loopLatency },
+    { "button", &buttonLatency },
+    { "mqtt", &mqttLatency }
+  };
+
+  char latencyBuffer[200];
+  int length = snprintf(latencyBuffer, sizeof(latencyBuffer), "{");
+  for (int i = 0; i < 3; i++) {
+    LatencyHistogram* h = reports[i].histogram;
+    Serial.printf("Latency %s: n=%lu p50=%luus p90=%luus p99=%luus max=%luus\n", reports[i].name,
+                  (unsigned long)h->getCount(), (unsigned long)h->percentile(50), (unsigned long)h->percentile(90),
+                  (unsigned long)h->percentile(99), (unsigned long)h->getMax());
+    length += snprintf(latencyBuffer + length, sizeof(latencyBuffer) - length, "%s\"%s\":[%lu,%lu,%lu]",
+                       i ? "," : "", reports[i].name, (unsigned long)h->percentile(50),
+                       (unsigned long)h->percentile(99), (unsigned long)h->getMax());
+    h->reset();
+  }
+  snprintf(latencyBuffer + length, sizeof(latencyBuffer) - length, "}");
+
+  if (client.connected() && !client.publish(MQTT_TOPIC_STATION_LATENCY, latencyBuffer)) {
+    diagnostics.countPublishFailure();
+  }
+}
+
+// Publish retained reservoir estimate, projected days left and low flag
+void publishReservoir() {
+  float daysLeft = reservoir.daysToEmpty(millis());
+  bool published = client.publish(MQTT_TOPIC_RESERVOIR_LITRES, String(reservoir.getLitres(), 2).c_str(), true)
+                   && client.publish(MQTT_TOPIC_RESERVOIR_DAYS_LEFT, String(daysLeft, 1).c_str(), true)
+                   && client.publish(MQTT_TOPIC_RESERVOIR_LOW, reservoir.isLow() ? "1" : "0", true);
+  if (!published) diagnostics.countPublishFailure();
+}
+
 // Load MQTT config from flash
 bool loadMQTTConfig() {
   preferences.begin("mqtt", true);
@@ -232,6 +396,75 @@ bool loadMQTTConfig() {
   return !MQTT_SERVER_IP.isEmpty();
 }
 
+// --------------------------------------------------------------------------
+// ------------------------- PUMP -------------------------------------------
+// --------------------------------------------------------------------------
+
+// Starts a run sized to what the reservoir can supply, refuses to run dry
+bool startPump(uint32_t triggerMicros, LatencyHistogram& latency) {
+  unsigned long runTime = reservoir.allowedRunTime(WATERING_DURATION);
+  if (runTime == 0) {
+    // Held button retries every loop, don't flood the log
+    static unsigned long lastBlockedLog = 0;
+    if (millis() - lastBlockedLog >= STATUS_LOG_INTERVAL) {
+      lastBlockedLog = millis();
+      Serial.println("Pump blocked - reservoir empty");
+      reservoirDirty = true;
+    }
+    buttonEdgeMicros = 0;
+    return false;
+  }
+
+  digitalWrite(PUMP_PIN, HIGH);
+  latency.record(micros() - triggerMicros);
+  pumpActive = true;
+  pumpStartTime = millis();
+  pumpRunDuration = runTime;
+  buttonEdgeMicros = 0;
+  diagnostics.countPumpRun();
+
+  if (runTime < WATERING_DURATION) Serial.println("Reservoir low - run shortened to " + String(runTime) + " ms");
+  return true;
+}
+
+void stopPump() {
+  digitalWrite(PUMP_PIN, LOW);
+  pumpActive = false;
+  reservoir.consume(millis() - pumpStartTime);
+  Serial.println("Pump deactivated, " + String(reservoir.getLitres(), 2) + " L left");
+  reservoirDirty = true;
+}
+
+void IRAM_ATTR onButtonFalling() {
+  // Keep the first edge, ignore contact bounce
+  if (buttonEdgeMicros == 0) buttonEdgeMicros = micros();
+}
+
+// --------------------------------------------------------------------------
+// ------------------------- OTA --------------------------------------------
+// --------------------------------------------------------------------------
+
+// Apply the requested update, report the result and reboot into the new image on success
+void runPendingUpdate() {
+  String url = pendingUpdateUrl;
+  pendingUpdateUrl = "";
+
+  bool updated = ota.update(url);
+
+  char statusBuffer[200];
+  ota.toJson(statusBuffer, sizeof(statusBuffer), "station");
+  if (client.connected() && !client.publish(MQTT_TOPIC_OTA_STATUS, statusBuffer)) {
+    diagnostics.countPublishFailure();
+  }
+
+  if (updated) {
+    Serial.println("OTA: restarting into new image");
+    client.disconnect();
+    delay(500);
+    ESP.restart();
+  }
+}
+
 // --------------------------------------------------------------------------
 // ------------------------- PREFERENCES ------------------------------------
 // --------------------------------------------------------------------------
@@ -354,6 +587,33 @@ void setupWebServer() {
     server.send(200, "text/html", success_html);
   });
 
+  // Runtime memory and counter metrics
+  server.on("/metrics", HTTP_GET, []() {
+    char metricsBuffer[400];
+    diagnostics.sample();
+    diagnostics.toMetrics(metricsBuffer, sizeof(metricsBuffer));
+    server.send(200, "text/plain", metricsBuffer);
+  });
+
+  // Manual refill, optional "litres" argument (default: full)
+  server.on("/refill", HTTP_POST, []() {
+    reservoir.refill(server.arg("litres").toFloat());
+    reservoirDirty = true;
+    server.send(200, "text/plain", String(reservoir.getLitres(), 2) + " L");
+  });
+
+  // Firmware update from a URL reachable by the station (e.g. a laptop on the portal network)
+  server.on("/update", HTTP_POST, []() {
+    String url = server.arg("url");
+    if (!url.startsWith("http://")) {
+      server.send(400, "text/plain", "Invalid update URL");
+      return;
+    }
+    server.sendHeader("Connection", "close");
+    server.send(202, "text/plain", "Updating");
+    pendingUpdateUrl = url;
+  });
+
   // Handle CORS preflight requests
   server.on("/config", HTTP_OPTIONS, []() {
     server.sendHeader("Access-Control-Allow-Origin", "*");
@@ -402,6 +662,7 @@ bool connectWiFi() {
   if (WiFi.status() == WL_CONNECTED) {
     Serial.println("WiFi connected: " + WiFi.localIP().toString());
     client.setServer(MQTT_SERVER_IP.c_str(), MQTT_SERVER_PORT);
+    client.setKeepAlive(MQTT_KEEPALIVE);
 
     // Get NTP time
     configTime(3600, 3600, NTP_SERVER_URL);